@@ -2,7 +2,8 @@
 	 File Name:   ameoba.c
 
 	 Program Name:  grav_parallel        
-	 Subroutine Name(s): evaluate(), optimize_params(), smooth_model()
+	 Subroutine Name(s): evaluate(), evaluate_vertices(), rebuild_simplex(), optimize_params(),
+	                     get_stall_state(), set_stall_state(), smooth_model()
 	 Release Date:         April 1, 2020
 	 Release Version:      1.0
 
@@ -57,7 +58,16 @@
                      (i.e. the number of sets of parameters being simultaneously modeled)
 										 this value is always one greater that the NUM_OF_PARAMS
 
+	 ADAPTIVE_SIMPLEX : if non-zero, the reflection, expansion, contraction and shrink
+	                    coefficients are scaled with the number of parameters
+	 STALL_EVALS : the number of evaluations over which progress is measured, 0 = never rebuild
+	 STALL_TOLERANCE : the relative improvement of the best value below which the simplex is rebuilt
+	 REBUILD_STEP : the size of a rebuilt simplex, as a fraction of each parameter's range
+
 	 REFERENCES: Numerical Recipies
+	             Gao, F. and Han, L., 2012, Implementing the Nelder-Mead simplex
+	             algorithm with adaptive parameters, Computational Optimization
+	             and Applications, 51: 259-277.
 	 
 	 PROGRAM FLOW:
 */
@@ -66,13 +76,15 @@
 #include <string.h>
 #include <errno.h>
 #include <math.h>
-#include <gc.h>
 #include "prototypes.h"
 
 #define TINY 1.0e-10
 
 #define SWAP(a,b) {swap=(a);(a)=(b);(b)=swap;}
 
+/* progress bookkeeping for detecting a stalled simplex (checkpointed) */
+static STALL stall = {0.0, 0, 0};
+
 //static double **MODEL_GRID = NULL;
 /************************************************************************************
  * INPUTS:
@@ -90,11 +102,16 @@ double evaluate(double op[][NUM_OF_PARAMS], double mfv[], double psum[],
 		double (*funk)(double []), int worst, double extrapolation_factor) {
 			
   int param;
-  double fac1,fac2,try,*ptry;
+  double fac1,fac2,try;
+  static double *ptry = NULL; /* the trial vertex, reused by every call */
   int prism_param; 
   
   /* if (DEBUG == 2) fprintf(stderr, "ENTER[evaluate]: worst=%d\n", worst); */
-  ptry = (double *)GC_MALLOC((size_t)NUM_OF_PARAMS * sizeof(double));
+  if (ptry == NULL) ptry = (double *)arena_alloc((size_t)NUM_OF_PARAMS * sizeof(double));
+  if (ptry == NULL) {
+    fprintf(stderr, "\t[evaluate]Cannot malloc memory for the trial vertex\n");
+    exit(1);
+  }
 
   fac1 = (1.0 - extrapolation_factor) / NUM_OF_PARAMS;
   fac2 = fac1 - extrapolation_factor;
@@ -126,6 +143,104 @@ double evaluate(double op[][NUM_OF_PARAMS], double mfv[], double psum[],
 }
 
 
+/************************************************************************************
+ * Evaluate the minimizing function at every vertex of the simplex (except one),
+ * BATCH_SIZE vertices at a time.
+ *
+ * INPUTS:
+ * double op[][NUM_OF_PARAMS]  :  (in) a 2-D array of optimal parameters
+ * double mfv[]    :  (out) an array of minimizing function return values
+ * int skip        :  (in) vertex that is not evaluated, -1 to evaluate all of them
+ * void (*bfunk)   :  (in) pointer to the batched minimizing function
+
+ * RETURN:  none
+ ***************************************************************************************/ 
+void evaluate_vertices(double op[][NUM_OF_PARAMS], double mfv[], int skip,
+		void (*bfunk)(double [], int, double [])) {
+
+  static double *batch = NULL; /* parameter sets of the current batch */
+  static double *fit = NULL; /* minimizing function value of each set */
+  static int *which = NULL; /* vertex of each set */
+  int vert, k, K = 0;
+
+  if (batch == NULL) {
+    batch = (double *)arena_alloc((size_t)BATCH_SIZE * NUM_OF_PARAMS * sizeof(double));
+    fit = (double *)arena_alloc((size_t)BATCH_SIZE * sizeof(double));
+    which = (int *)arena_alloc((size_t)BATCH_SIZE * sizeof(int));
+    if (batch == NULL || fit == NULL || which == NULL) {
+      fprintf(stderr, "\t[evaluate_vertices]Cannot malloc memory for batch:[%s]\n",
+	      strerror(errno));
+      exit(1);
+    }
+  }
+
+  for (vert = 0; vert < NUM_OF_VERTICES; vert++) {
+    if (vert == skip) continue;
+    memcpy(batch + K * NUM_OF_PARAMS, op[vert], (size_t)NUM_OF_PARAMS * sizeof(double));
+    which[K++] = vert;
+    if (K == BATCH_SIZE) {
+      (*bfunk)(batch, K, fit);
+      for (k = 0; k < K; k++) mfv[which[k]] = fit[k];
+      K = 0;
+    }
+  }
+  if (K) {
+    (*bfunk)(batch, K, fit);
+    for (k = 0; k < K; k++) mfv[which[k]] = fit[k];
+  }
+}
+
+/************************************************************************************
+ * Rebuild the simplex around the best vertex. Every other vertex is replaced by
+ * the best vertex displaced along one coordinate axis by REBUILD_STEP of that
+ * parameter's range (away from the nearest bound), and is then re-evaluated.
+ *
+ * INPUTS:
+ * double op[][NUM_OF_PARAMS]  :  (in/out) a 2-D array of optimal parameters
+ * double mfv[]    :  (in/out) an array of minimizing function return values
+ * double psum[]   :  (out) column sums of the simplex
+ * void (*bfunk)   :  (in) pointer to the batched minimizing function
+ * int best        :  (in) vertex with the lowest value
+
+ * RETURN:  none
+ ***************************************************************************************/ 
+static void rebuild_simplex(double op[][NUM_OF_PARAMS], double mfv[], double psum[], 
+		void (*bfunk)(double [], int, double []), int best) {
+
+  int param, vert, axis;
+  int prism_param;
+  double step, sum;
+
+  for (vert = 0; vert < NUM_OF_VERTICES; vert++) {
+    if (vert == best) continue;
+    axis = (vert < best) ? vert : vert - 1;
+    prism_param = axis;
+    if (prism_param > 1) prism_param = DEPTH_TO_BOT;
+
+    for (param = 0; param < NUM_OF_PARAMS; param++)
+      op[vert][param] = op[best][param];
+    step = REBUILD_STEP * (HI_PARAM(prism_param) - LO_PARAM(prism_param));
+    if (op[best][axis] + step > HI_PARAM(prism_param)) step = -step;
+    op[vert][axis] += step;
+    test_bounds(prism_param, &op[vert][axis], op[vert][0]);
+  }
+  evaluate_vertices(op, mfv, best, bfunk);
+
+  /* GET PSUM (i.e. sum up each column of parameters) */
+  for (param = 0; param < NUM_OF_PARAMS; param++) {
+    for (sum = 0.0, vert = 0; vert < NUM_OF_VERTICES; vert++) sum += op[vert][param];
+    psum[param] = sum;
+  }
+}
+
+void get_stall_state(STALL *s) {
+  *s = stall;
+}
+
+void set_stall_state(STALL *s) {
+  stall = *s;
+}
+
 /***********************************************************************************************
  * INPUTS:
  * double op[][NUM_OF_PARAMS]  :  a 2-D array,
@@ -134,32 +249,47 @@ double evaluate(double op[][NUM_OF_PARAMS], double mfv[], double psum[],
  *                                (i.e. the coordinates of a vertex in n-dimensional space)
  *
  * double mfv[]  :  array of minimizing function returns for each vertex
+ * double psum[] :  (in/out) column sums of the simplex
  * double tol    :  tolerance
  * double (*funk):  minimizing_function
+ * void (*bfunk) :  batched minimizing function, used when many vertices change at once
+ * int *num_evals:  (in/out) number of function evaluations taken
+ * int resume    :  if non-zero, psum and num_evals were restored from a checkpoint
 
  * RETURN: none
  ************************************************************************************************/ 
-void optimize_params(double op[][NUM_OF_PARAMS], double mfv[], double tol,
-		     double (*funk)(double []), int *num_evals) {
+void optimize_params(double op[][NUM_OF_PARAMS], double mfv[], double psum[], double tol,
+		     double (*funk)(double []), void (*bfunk)(double [], int, double []),
+		     int *num_evals, int resume) {
   int param, vert;
   int worst; /* vertex with the highest value */
   int better; /* vertex with the next-highest value */
   int best; /* vertex with the lowest value */
-  double rtol, sum, swap, save, try, *psum;
+  int last_checkpoint; /* evaluation count at the last checkpoint */
+  double rtol, sum, swap, save, try;
+  double reflect, expand, contract, shrink; /* simplex coefficients */
   /* int i; */
 
   
   fprintf(stderr, "ENTER[optimize_params] ...\n");
 
-  psum=(double *)GC_MALLOC((size_t)NUM_OF_PARAMS * sizeof(double));
-  if (psum == NULL) {
-    fprintf(stderr, "\t[optimize_params]Cannot malloc memory for psum:[%s]\n",
-	    strerror(errno));
-    return;
+  /* The classic coefficients (1, 2, 1/2, 1/2) make the simplex stall when there
+     are many parameters; Gao and Han (2012) scale them with the dimension. */
+  if (ADAPTIVE_SIMPLEX) {
+    reflect = 1.0;
+    expand = 1.0 + 2.0 / NUM_OF_PARAMS;
+    contract = 0.75 - 1.0 / (2.0 * NUM_OF_PARAMS);
+    shrink = 1.0 - 1.0 / NUM_OF_PARAMS;
+  } else {
+    reflect = 1.0;
+    expand = 2.0;
+    contract = 0.5;
+    shrink = 0.5;
   }
-  *num_evals = 0;
+  fprintf(stderr, "\tReflect=%.4f Expand=%.4f Contract=%.4f Shrink=%.4f\n", 
+          reflect, expand, contract, shrink);
 
-/*MODEL_GRID = (double **)GC_MALLOC((size_t)ROWS * sizeof(double));
+/*MODEL_GRID = (double **)arena_alloc((size_t)ROWS * sizeof(double));
   if (MODEL_GRID == NULL) {
     fprintf(stderr, "Cannot malloc memory for MODEL_GRID rows:[%s]\n",
 	    strerror(errno));
@@ -167,7 +297,7 @@ void optimize_params(double op[][NUM_OF_PARAMS], double mfv[], double tol,
   } 
   else {
     for (i=0; i < ROWS; i++) {
-      MODEL_GRID[i] = (double *)GC_MALLOC((size_t)COLS * sizeof(double));
+      MODEL_GRID[i] = (double *)arena_alloc((size_t)COLS * sizeof(double));
       if (MODEL_GRID[i] == NULL) {
 	fprintf(stderr, "Cannot malloc memory for grid row %d:[%s]\n",
 		i, strerror(errno));
@@ -177,13 +307,21 @@ void optimize_params(double op[][NUM_OF_PARAMS], double mfv[], double tol,
   } 
 */
 
-  /* GET PSUM (i.e. sum up each column of parameter values) */
-  for (param = 0; param < NUM_OF_PARAMS; param++) {
-    for (sum = 0.0, vert = 0; vert < NUM_OF_VERTICES; vert++) 
-      sum += op[vert][param];
-    psum[param] = sum;
+  if (!resume) {
+    *num_evals = 0;
+    stall.best = HUGE_VAL;
+    stall.start = 0;
+    stall.rebuilds = 0;
+    
+    /* GET PSUM (i.e. sum up each column of parameter values) */
+    for (param = 0; param < NUM_OF_PARAMS; param++) {
+      for (sum = 0.0, vert = 0; vert < NUM_OF_VERTICES; vert++) 
+        sum += op[vert][param];
+      psum[param] = sum;
 
-  } 
+    } 
+  }
+  last_checkpoint = *num_evals;
 
   for (;;) {
    
@@ -206,6 +344,26 @@ void optimize_params(double op[][NUM_OF_PARAMS], double mfv[], double tol,
 	   break;
     }
     
+    /* The simplex is consistent at the top of each iteration; save it here
+       periodically, and one last time if the job is being terminated. */
+    if (checkpoint_requested()) {
+      fprintf(stderr, "\n\t[optimize_params]SIGTERM: checkpoint at %d evaluations\n", *num_evals);
+      phase_begin(PHASE_OUTPUT);
+      (void) write_checkpoint(op, mfv, psum, *num_evals);
+      phase_end();
+      SWAP(mfv[0], mfv[best])
+	   for (param = 0; param < NUM_OF_PARAMS; param++) 
+	     SWAP(op[0][param], op[best][param]) 
+	   break;
+    }
+    if (CHECKPOINT_INTERVAL > 0 && *num_evals - last_checkpoint >= CHECKPOINT_INTERVAL) {
+      phase_begin(PHASE_OUTPUT);
+      if (!write_checkpoint(op, mfv, psum, *num_evals))
+        fprintf(stderr, "ckpt->out ");
+      phase_end();
+      last_checkpoint = *num_evals;
+    }
+    
     if (*num_evals >= NMAX) {
       fprintf(stderr, "\t[optimize_params]NMAX[%d] exceeded\n",NMAX);
       SWAP(mfv[0], mfv[best])
@@ -214,22 +372,40 @@ void optimize_params(double op[][NUM_OF_PARAMS], double mfv[], double tol,
 	   break;
     }
     
+ 
+    /* If the best value has not improved enough over the last STALL_EVALS
+       evaluations, restart from the best vertex with a freshly built simplex. */
+    if (STALL_EVALS > 0 && *num_evals - stall.start >= STALL_EVALS) {
+      if (stall.best - mfv[best] < STALL_TOLERANCE * fabs(mfv[best])) {
+        stall.rebuilds++;
+        fprintf(stderr, "\n\t[optimize_params]Stalled at %d evaluations (RMSE=%f), rebuilding simplex[%d]\n",
+                *num_evals, mfv[best], stall.rebuilds);
+        rebuild_simplex(op, mfv, psum, bfunk, best);
+        *num_evals += NUM_OF_PARAMS;
+        stall.best = mfv[best];
+        stall.start = *num_evals;
+        continue;
+      }
+      stall.best = mfv[best];
+      stall.start = *num_evals;
+    }
+    
     *num_evals += 2;
  
     /* Begin a new iteration 
-       First extrapolate by a factor of -1. 
+       First extrapolate by a factor of -reflect. 
     */
 
-    try = evaluate(op, mfv, psum, funk, worst, -1.0);
+    try = evaluate(op, mfv, psum, funk, worst, -reflect);
     // fprintf(stderr, "%d[%.1f][%.1f]  ", *num_evals, try, mfv[best]);
     
     /* If <try> gives a result better than the best,
-       then try an extra extapolation by a factor of 2.
+       then try an extra extapolation by a factor of expand.
     */
     if (try <= mfv[best]) {
     	// fprintf(stderr, "eval->Best  ");
       fprintf(stderr, "%d[%.4f]  ", *num_evals, try);
-      try = evaluate(op, mfv, psum, funk, worst, 2.0);
+      try = evaluate(op, mfv, psum, funk, worst, expand);
     }
      
     /* If <try> is worse than the 'better' ,
@@ -239,20 +415,20 @@ void optimize_params(double op[][NUM_OF_PARAMS], double mfv[], double tol,
     	// fprintf(stderr, "%d-BEST[%d]=%.1f  ", *num_evals, better, try);
       save = mfv[worst]; 
       fprintf(stderr, "^");    
-      try = evaluate(op, mfv, psum, funk, worst, 0.5);    
+      try = evaluate(op, mfv, psum, funk, worst, contract);    
       
       /* If <try> is still worse than the worst,
-	      contract around the best vertex. */
+	      contract around the best vertex by a factor of shrink. */
       if (try >= save) {
         fprintf(stderr, "<>");	
 	     for (vert = 0; vert < NUM_OF_VERTICES; vert++) {
 	       if (vert != best) {
 	         for (param = 0; param < NUM_OF_PARAMS; param++)
-	           op[vert][param] = psum[param] = 0.5 *(op[vert][param] + op[best][param]);
-	         mfv[vert] = (*funk)(psum);
+	           op[vert][param] = (1.0 - shrink) * op[best][param] + shrink * op[vert][param];
 	       }
 	       // else fprintf(stderr, "%d-contract_to_VERT[%d] ", *num_evals, vert);
 	     }
+	     evaluate_vertices(op, mfv, best, bfunk);
 	     *num_evals += NUM_OF_PARAMS;
 	
 	     /* GET PSUM (i.e. sum up each column of parameters) */
@@ -266,10 +442,12 @@ void optimize_params(double op[][NUM_OF_PARAMS], double mfv[], double tol,
     else --(*num_evals);
     /* if (DEBUG) fprintf(stderr, "\t[optimize_params]NUM_EVAL=%d VERT=%d CHI=%f\n", *num_evals, best, try); */ 
     
+    /* The best model so far goes to the output writer (see dump_best()) */
     if (!(*num_evals % 1000)) {
       fprintf(stderr, "model->out ");
-      printout_model();
-      printout_points();
+      phase_begin(PHASE_OUTPUT);
+      dump_best();
+      phase_end();
     }
   }
 /*free(psum);
@@ -0,0 +1,239 @@
+/*
+	 File Name:   arena.c
+
+	 Program Name:  grav_parallel
+	 Subroutine Name(s): arena_alloc(), scratch_buffer(), temp_alloc(),
+	                     temp_free(), arena_release(), arena_allocations(),
+	                     arena_held()
+	 Release Date:         April 1, 2020
+	 Release Version:      1.0
+
+	 VERSION/REVISION HISTORY
+
+	 Explicit memory management, in place of the garbage collector.
+
+	 DISCLAIMER/NOTICE
+
+	 This computer code/material was prepared as an account of work
+	 performed by the Center for Nuclear Waste Regulatory Analyses (CNWRA)
+	 for the Division of Waste Management of the Nuclear Regulatory
+	 Commission (NRC), an independent agency of the United States
+	 Government. The developer(s) of the code nor any of their sponsors
+	 make any warranty, expressed or implied, or assume any legal
+	 liability or responsibility for the accuracy, completeness, or
+	 usefulness of any information, apparatus, product or process
+	 disclosed, or represent that its use would not infringe on
+	 privately-owned rights.
+
+	 IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW WILL THE SPONSORS
+	 OR THOSE WHO HAVE WRITTEN OR MODIFIED THIS CODE, BE LIABLE FOR
+	 DAMAGES, INCLUDING ANY LOST PROFITS, LOST MONIES, OR OTHER SPECIAL,
+	 INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+	 INABILITY TO USE (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+	 BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY THIRD PARTIES OR A
+	 FAILURE OF THE PROGRAM TO OPERATE WITH OTHER PROGRAMS) THE PROGRAM,
+	 EVEN IF YOU HAVE BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGES,
+	 OR FOR ANY CLAIM BY ANY OTHER PARTY.
+
+
+	 PURPOSE:
+	 Nearly all of the program's memory is allocated once and kept until
+	 the end of the run: the points, the prisms, the simplex and the 
+	 buffers of the minimizing functions. arena_alloc() hands such storage
+	 out of large blocks, so it costs a pointer increment rather than a
+	 call to malloc(), and arena_release() frees it all at the end.
+
+	 Storage that is made again from time to time (the points of a node
+	 after they are repartitioned, the rows of a binary field file, the
+	 int counts of the collectives) comes from a few scratch buffers,
+	 which are kept and only grown when a larger one is needed. One-off
+	 temporaries (e.g. for sorting) are allocated and freed explicitly 
+	 with temp_alloc() and temp_free().
+
+	 Every call to malloc() made here is counted, so that the run can 
+	 report how many were made while the simplex was optimized (there
+	 should be none once the first evaluation is done). All of the
+	 storage is zeroed, as it was by the garbage collector. These 
+	 subroutines are only called from each node's main thread.
+
+	 PROGRAMMING LANGUAGE:  ANSI C
+
+	 GLOBAL VARIABLES:
+
+	 REFERENCES:
+
+	 PROGRAM FLOW:
+	 arena_alloc(), scratch_buffer(), temp_alloc() as needed; 
+	 arena_release() before the program exits.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "prototypes.h"
+
+#define ARENA_BLOCK ((size_t)4 << 20) /* bytes per block; larger requests get a block of their own */
+#define ARENA_ALIGN 64 /* every allocation starts on a cache line */
+
+/* a block of long-lived storage */
+typedef struct arena_block {
+  struct arena_block *next; /* the blocks allocated before this one */
+  size_t size; /* bytes of storage in the block */
+  size_t used; /* bytes handed out */
+  char *data; /* the storage, ARENA_ALIGN aligned */
+} ARENA_BLOCK_HEAD;
+
+static ARENA_BLOCK_HEAD *blocks = NULL; /* the block being filled, then the older ones */
+static void *scratch[SCRATCH_BUFFERS]; /* see scratch_buffer() */
+static size_t scratch_size[SCRATCH_BUFFERS];
+static unsigned long allocations = 0; /* calls to malloc() made so far */
+static size_t held = 0; /* bytes held in blocks and scratch buffers */
+
+/****************************************************************
+FUNCTION: new_block
+DESCRIPTION: Allocates a zeroed block of long-lived storage.
+INPUTS: (IN) size_t size  (bytes of storage)
+OUTPUTS: ARENA_BLOCK_HEAD *, the block, or NULL on error
+*****************************************************************/
+static ARENA_BLOCK_HEAD *new_block(size_t size) {
+
+  ARENA_BLOCK_HEAD *b;
+
+  b = (ARENA_BLOCK_HEAD *)calloc(1, sizeof(ARENA_BLOCK_HEAD) + size + ARENA_ALIGN);
+  if (b == NULL) return NULL;
+  b->data = (char *)(((uintptr_t)(b + 1) + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1));
+  b->size = size;
+  allocations++;
+  held += size;
+  return b;
+}
+
+/****************************************************************
+FUNCTION: arena_alloc
+DESCRIPTION: Allocates zeroed storage that is kept until 
+arena_release().
+INPUTS: (IN) size_t bytes
+OUTPUTS: void *, the storage, or NULL on error
+*****************************************************************/
+void *arena_alloc(size_t bytes) {
+
+  ARENA_BLOCK_HEAD *b;
+  void *p;
+
+  bytes = (bytes + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if (bytes == 0) bytes = ARENA_ALIGN;
+  
+  /* a large request gets its own block, behind the block being filled */
+  if (bytes > ARENA_BLOCK / 4) {
+    if ((b = new_block(bytes)) == NULL) return NULL;
+    b->used = bytes;
+    if (blocks == NULL) blocks = b;
+    else {
+      b->next = blocks->next;
+      blocks->next = b;
+    }
+    return b->data;
+  }
+  if (blocks == NULL || blocks->size - blocks->used < bytes) {
+    if ((b = new_block(ARENA_BLOCK)) == NULL) return NULL;
+    b->next = blocks;
+    blocks = b;
+  }
+  p = blocks->data + blocks->used;
+  blocks->used += bytes;
+  return p;
+}
+
+/****************************************************************
+FUNCTION: scratch_buffer
+DESCRIPTION: Returns scratch buffer <which> (SCRATCH_POINTS ...), 
+zeroed and at least <bytes> long. The buffer is reused by the next 
+call for the same <which>; it is only reallocated when it is too small,
+and what it held is then lost.
+INPUTS: (IN) int which  (the buffer)
+        (IN) size_t bytes
+OUTPUTS: void *, the buffer, or NULL on error
+*****************************************************************/
+void *scratch_buffer(int which, size_t bytes) {
+
+  if (bytes == 0) bytes = 1;
+  if (bytes > scratch_size[which]) {
+    free(scratch[which]);
+    held -= scratch_size[which];
+    scratch[which] = malloc(bytes);
+    scratch_size[which] = (scratch[which] != NULL) ? bytes : 0;
+    held += scratch_size[which];
+    allocations++;
+    if (scratch[which] == NULL) return NULL;
+  }
+  memset(scratch[which], 0, bytes);
+  return scratch[which];
+}
+
+/****************************************************************
+FUNCTION: temp_alloc
+DESCRIPTION: Allocates zeroed storage for a one-off temporary; it 
+must be given back with temp_free().
+INPUTS: (IN) size_t bytes
+OUTPUTS: void *, the storage, or NULL on error
+*****************************************************************/
+void *temp_alloc(size_t bytes) {
+  allocations++;
+  return calloc(1, bytes ? bytes : 1);
+}
+
+/****************************************************************
+FUNCTION: temp_free
+DESCRIPTION: Frees storage from temp_alloc().
+INPUTS: (IN) void *p  (may be NULL)
+OUTPUTS: none
+*****************************************************************/
+void temp_free(void *p) {
+  free(p);
+}
+
+/****************************************************************
+FUNCTION: arena_release
+DESCRIPTION: Frees all of the long-lived storage and the scratch 
+buffers. Nothing they held may be used afterwards.
+INPUTS: none
+OUTPUTS: none
+*****************************************************************/
+void arena_release(void) {
+
+  ARENA_BLOCK_HEAD *b;
+  int i;
+
+  while (blocks != NULL) {
+    b = blocks;
+    blocks = b->next;
+    free(b);
+  }
+  for (i = 0; i < SCRATCH_BUFFERS; i++) {
+    free(scratch[i]);
+    scratch[i] = NULL;
+    scratch_size[i] = 0;
+  }
+  held = 0;
+}
+
+/****************************************************************
+FUNCTION: arena_allocations
+DESCRIPTION: The number of calls to malloc() made so far.
+INPUTS: none
+OUTPUTS: unsigned long
+*****************************************************************/
+unsigned long arena_allocations(void) {
+  return allocations;
+}
+
+/****************************************************************
+FUNCTION: arena_held
+DESCRIPTION: The bytes of long-lived storage and scratch buffers 
+currently held.
+INPUTS: none
+OUTPUTS: size_t
+*****************************************************************/
+size_t arena_held(void) {
+  return held;
+}
@@ -0,0 +1,194 @@
+/*
+	 File Name:   basis.c
+
+	 Program Name:  grav_parallel
+	 Subroutine Name(s): basis_setup(), basis_expand()
+	 Release Date:         April 1, 2020
+	 Release Version:      1.0
+
+	 VERSION/REVISION HISTORY
+
+	 Smooth parameterization of the bottom surface.
+
+
+	 DISCLAIMER/NOTICE
+
+	 This computer code/material was prepared as an account of work
+	 performed by the Center for Nuclear Waste Regulatory Analyses (CNWRA)
+	 for the Division of Waste Management of the Nuclear Regulatory
+	 Commission (NRC), an independent agency of the United States
+	 Government. The developer(s) of the code nor any of their sponsors
+	 make any warranty, expressed or implied, or assume any legal
+	 liability or responsibility for the accuracy, completeness, or
+	 usefulness of any information, apparatus, product or process
+	 disclosed, or represent that its use would not infringe on
+	 privately-owned rights.
+
+	 IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW WILL THE SPONSORS
+	 OR THOSE WHO HAVE WRITTEN OR MODIFIED THIS CODE, BE LIABLE FOR
+	 DAMAGES, INCLUDING ANY LOST PROFITS, LOST MONIES, OR OTHER SPECIAL,
+	 INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+	 INABILITY TO USE (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+	 BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY THIRD PARTIES OR A
+	 FAILURE OF THE PROGRAM TO OPERATE WITH OTHER PROGRAMS) THE PROGRAM,
+	 EVEN IF YOU HAVE BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGES,
+	 OR FOR ANY CLAIM BY ANY OTHER PARTY.
+
+
+	 PURPOSE:
+	 With one parameter per prism the simplex grows with the grid, and
+	 beyond a few hundred prisms it hardly moves. With PARAMETERIZATION
+	 bspline the bottom surface is instead a bicubic B-spline over the
+	 interior of the grid, and the parameters are its BASIS_ROWS by
+	 BASIS_COLS control values (depths to bottom, row by row from the
+	 north-west). The depth to bottom of each free prism is the spline at
+	 the prism's center.
+
+	 The spline is clamped at the edges of the interior, and its basis
+	 functions are non-negative and add up to one everywhere, so every
+	 depth is a weighted average of the control values: control values
+	 within the depth to bottom bounds (see test_bounds()) give depths
+	 within the same bounds. Fewer than 4 control values along an axis
+	 give a spline of lower degree (3: quadratic, 2: linear, 1: constant).
+
+	 PROGRAMMING LANGUAGE:  ANSI C
+
+	 GLOBAL VARIABLES:
+
+	 BASIS_ROWS, BASIS_COLS : the size of the lattice of control values
+
+	 REFERENCES:
+	 de Boor, C., 1978, A Practical Guide to Splines: Springer-Verlag.
+
+	 PROGRAM FLOW:
+	 basis_setup() once, by every process, after create_index(); then
+	 basis_expand() for every parameter set to be evaluated.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "prototypes.h"
+
+static int rows = 0, cols = 0; /* the interior of the model grid */
+static int num_cells = 0; /* number of free prisms */
+static int *cell_row = NULL, *cell_col = NULL; /* interior row and column of each free prism */
+static double *row_weight = NULL; /* [row][BASIS_ROWS], the weight of each control row */
+static double *col_weight = NULL; /* [col][BASIS_COLS], the weight of each control column */
+static double *partial = NULL; /* [BASIS_ROWS][col], the spline along each control row */
+
+/****************************************************************
+FUNCTION: spline_weights
+DESCRIPTION: The clamped uniform B-spline basis functions of <m>
+control values at the centers of <n> cells along one axis (the
+Cox-de Boor recursion).
+INPUTS: (IN) int n  (number of cells)
+        (IN) int m  (number of control values)
+        (OUT) double *w  (w[i * m + a]: basis function a at cell i)
+OUTPUTS: int 1=error, 0=no error
+*****************************************************************/
+static int spline_weights(int n, int m, double *w) {
+
+  int d = (m > 4) ? 3 : m - 1; /* the degree */
+  int nk = m + d + 1; /* number of knots */
+  int i, a, p, k;
+  double *knot, *N, u, left, right;
+
+  knot = (double *)temp_alloc((size_t)(2 * nk) * sizeof(double));
+  if (knot == NULL) return 1;
+  N = knot + nk;
+  for (k = 0; k < nk; k++) 
+    knot[k] = (k <= d) ? 0.0 : (k >= m) ? 1.0 : (double)(k - d) / (m - d);
+
+  for (i = 0; i < n; i++) {
+    u = (i + 0.5) / n;
+    for (a = 0; a < nk - 1; a++) N[a] = (knot[a] <= u && u < knot[a+1]) ? 1.0 : 0.0;
+    for (p = 1; p <= d; p++)
+      for (a = 0; a < nk - 1 - p; a++) {
+        left = (knot[a+p] > knot[a]) ? (u - knot[a]) / (knot[a+p] - knot[a]) * N[a] : 0.0;
+        right = (knot[a+p+1] > knot[a+1]) ? (knot[a+p+1] - u) / (knot[a+p+1] - knot[a+1]) * N[a+1] : 0.0;
+        N[a] = left + right;
+      }
+    for (a = 0; a < m; a++) w[i * m + a] = N[a];
+  }
+  temp_free(knot);
+  return 0;
+}
+
+/****************************************************************
+FUNCTION: basis_setup
+DESCRIPTION: Finds the free prisms and the weights of the control
+values at their centers.
+INPUTS: (IN) const int *index  (the parameter of each prism, see
+             create_index())
+        (IN) PARAMETER P  (the model grid)
+OUTPUTS: int, the number of control values, or -1 on error
+*****************************************************************/
+int basis_setup(const int *index, PARAMETER P) {
+
+  int x, y, cell;
+
+  rows = P.row - 2;
+  cols = P.col - 2;
+  if (BASIS_ROWS < 1 || BASIS_ROWS > rows || BASIS_COLS < 1 || BASIS_COLS > cols) {
+    fprintf(stderr, "BASIS_ROWS=%d and BASIS_COLS=%d must be from 1 to the %d by %d interior prisms\n",
+            BASIS_ROWS, BASIS_COLS, rows, cols);
+    return -1;
+  }
+  num_cells = 0;
+  for (cell = 0; cell < P.N_units; cell++) 
+    if (index[cell] >= DEPTH_TO_BOT) num_cells++;
+
+  cell_row = (int *)arena_alloc((size_t)(2 * num_cells + 1) * sizeof(int));
+  row_weight = (double *)arena_alloc((size_t)rows * BASIS_ROWS * sizeof(double));
+  col_weight = (double *)arena_alloc((size_t)cols * BASIS_COLS * sizeof(double));
+  partial = (double *)arena_alloc((size_t)BASIS_ROWS * cols * sizeof(double));
+  if (cell_row == NULL || row_weight == NULL || col_weight == NULL || partial == NULL ||
+      spline_weights(rows, BASIS_ROWS, row_weight) || spline_weights(cols, BASIS_COLS, col_weight)) {
+    fprintf(stderr, "Cannot malloc memory for the basis:[%s]\n", strerror(errno));
+    return -1;
+  }
+  cell_col = cell_row + num_cells;
+
+  /* in the order of their parameters */
+  for (y = 1; y < P.row - 1; y++)
+    for (x = 1; x < P.col - 1; x++) {
+      cell = index[y * P.col + x] - DEPTH_TO_BOT;
+      if (cell < 0) continue;
+      cell_row[cell] = y - 1;
+      cell_col[cell] = x - 1;
+    }
+  return BASIS_ROWS * BASIS_COLS;
+}
+
+/****************************************************************
+FUNCTION: basis_expand
+DESCRIPTION: Expands a parameter set of control values into a 
+parameter set of prism depths, which gbox() reads like any other
+(see create_index()). The spline is evaluated along the control
+rows first, then across them.
+INPUTS: (IN) const double *coef  (depth to top, density, and the
+             control values)
+        (OUT) double *depths  (depth to top, density, and the depth
+              to bottom of each free prism)
+OUTPUTS: none
+*****************************************************************/
+void basis_expand(const double *coef, double *depths) {
+
+  int a, b, x, cell;
+  const double *c = coef + DEPTH_TO_BOT;
+  double sum;
+
+  depths[DEPTH_TO_TOP] = coef[DEPTH_TO_TOP];
+  depths[DENSITY] = coef[DENSITY];
+  for (a = 0; a < BASIS_ROWS; a++)
+    for (x = 0; x < cols; x++) {
+      for (sum = 0.0, b = 0; b < BASIS_COLS; b++) sum += col_weight[x * BASIS_COLS + b] * c[a * BASIS_COLS + b];
+      partial[a * cols + x] = sum;
+    }
+  for (cell = 0; cell < num_cells; cell++) {
+    for (sum = 0.0, a = 0; a < BASIS_ROWS; a++) 
+      sum += row_weight[cell_row[cell] * BASIS_ROWS + a] * partial[a * cols + cell_col[cell]];
+    depths[DEPTH_TO_BOT + cell] = sum;
+  }
+}
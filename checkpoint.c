@@ -0,0 +1,236 @@
+/*
+	 File Name:   checkpoint.c
+
+	 Program Name:  grav_parallel
+	 Subroutine Name(s): write_checkpoint(), read_checkpoint(),
+	                     install_signal_handlers(), checkpoint_requested()
+	 Release Date:         April 1, 2020
+	 Release Version:      1.0
+
+	 VERSION/REVISION HISTORY
+
+	 Checkpoint/restart of the simplex state.
+
+
+	 DISCLAIMER/NOTICE
+
+	 This computer code/material was prepared as an account of work
+	 performed by the Center for Nuclear Waste Regulatory Analyses (CNWRA)
+	 for the Division of Waste Management of the Nuclear Regulatory
+	 Commission (NRC), an independent agency of the United States
+	 Government. The developer(s) of the code nor any of their sponsors
+	 make any warranty, expressed or implied, or assume any legal
+	 liability or responsibility for the accuracy, completeness, or
+	 usefulness of any information, apparatus, product or process
+	 disclosed, or represent that its use would not infringe on
+	 privately-owned rights.
+
+	 IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW WILL THE SPONSORS
+	 OR THOSE WHO HAVE WRITTEN OR MODIFIED THIS CODE, BE LIABLE FOR
+	 DAMAGES, INCLUDING ANY LOST PROFITS, LOST MONIES, OR OTHER SPECIAL,
+	 INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+	 INABILITY TO USE (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+	 BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY THIRD PARTIES OR A
+	 FAILURE OF THE PROGRAM TO OPERATE WITH OTHER PROGRAMS) THE PROGRAM,
+	 EVEN IF YOU HAVE BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGES,
+	 OR FOR ANY CLAIM BY ANY OTHER PARTY.
+
+
+	 PURPOSE:
+	 These subroutines save and restore the complete state of the simplex
+	 (every vertex, the minimizing function value at each vertex, the column
+	 sums, the evaluation count and the stall bookkeeping) together with the
+	 random number generator state, so that an interrupted inversion can be
+	 resumed exactly where it stopped. The partition of the points among the
+	 nodes is not saved: with REBALANCE_INTERVAL it follows the measured
+	 speed of the nodes, so a rebalanced run resumes only to within rounding
+	 (and is not reproducible from one run to the next either). The
+	 checkpoint is a native-endian binary file; it is first
+	 written to a temporary file and then renamed over the old checkpoint,
+	 so a partially written checkpoint is never left behind.
+
+	 PROGRAMMING LANGUAGE:  ANSI C
+
+	 GLOBAL VARIABLES:
+
+	 NUM_OF_PARAMS : an integer,  the number of prism parameters that will be simultaneously modeled
+	 NUM_OF_VERTICES : an integer, the number of vertices of the simplex model
+	 CHECKPOINT_FILE : the name of the checkpoint file
+
+	 REFERENCES:
+
+	 PROGRAM FLOW:
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include "prototypes.h"
+
+#define CHECKPOINT_MAGIC "GRAVCKPT"
+#define CHECKPOINT_VERSION 2
+
+/* fixed-size header at the start of every checkpoint file */
+typedef struct checkpoint_header {
+  char magic[8]; /* CHECKPOINT_MAGIC, not null terminated */
+  int version; /* CHECKPOINT_VERSION */
+  int size_of_double; /* guards against reading a checkpoint from a different platform */
+  int num_params; /* NUM_OF_PARAMS when the checkpoint was written */
+  int num_vertices; /* NUM_OF_VERTICES when the checkpoint was written */
+  int num_evals; /* number of function evaluations taken so far */
+  unsigned int seed; /* random number seed */
+  unsigned long rand_draws; /* number of random numbers drawn since seeding */
+  STALL stall; /* progress bookkeeping of the simplex restarts */
+} CHECKPOINT_HEADER;
+
+/* set by the signal handler, polled by the optimizer */
+static volatile sig_atomic_t STOP_REQUESTED = 0;
+
+/****************************************************************
+FUNCTION: catch_sigterm
+DESCRIPTION: Signal handler for SIGTERM. It only records that the
+signal arrived; the optimizer writes a checkpoint and stops at the
+start of its next iteration.
+INPUTS: (IN) int sig  (the signal number)
+OUTPUTS: none
+*****************************************************************/
+static void catch_sigterm(int sig) {
+  STOP_REQUESTED = 1;
+}
+
+/****************************************************************
+FUNCTION: install_signal_handlers
+DESCRIPTION: Every node catches SIGTERM so that a preempted job is
+not killed before the master has written its checkpoint. The slave
+nodes keep waiting for the master's quit signal.
+INPUTS: none
+OUTPUTS: none
+*****************************************************************/
+void install_signal_handlers(void) {
+
+  struct sigaction sa;
+
+  memset(&sa, 0, sizeof sa);
+  sa.sa_handler = catch_sigterm;
+  sigemptyset(&sa.sa_mask);
+  (void) sigaction(SIGTERM, &sa, NULL);
+}
+
+/****************************************************************
+FUNCTION: checkpoint_requested
+DESCRIPTION: Reports whether a SIGTERM has been received.
+INPUTS: none
+OUTPUTS: int 1=stop requested, 0=keep going
+*****************************************************************/
+int checkpoint_requested(void) {
+  return (int)STOP_REQUESTED;
+}
+
+/****************************************************************
+FUNCTION: write_checkpoint
+DESCRIPTION: Writes the simplex and the random number generator
+state to CHECKPOINT_FILE. The data are written to a temporary file,
+flushed to disk and then renamed, so that the previous checkpoint
+survives if the job is killed while writing.
+INPUTS: (IN) double op[][NUM_OF_PARAMS]  (the simplex vertices)
+        (IN) double mfv[]  (minimizing function value at each vertex)
+        (IN) double psum[]  (column sums of the simplex)
+        (IN) int num_evals  (number of function evaluations so far)
+OUTPUTS: int 1=error, 0=no error
+*****************************************************************/
+int write_checkpoint(double op[][NUM_OF_PARAMS], double mfv[], double psum[], int num_evals) {
+
+  CHECKPOINT_HEADER head;
+  char tmp_name[MAX_FILENAME + 8];
+  FILE *out;
+  int ok;
+
+  memset(&head, 0, sizeof head);
+  memcpy(head.magic, CHECKPOINT_MAGIC, sizeof head.magic);
+  head.version = CHECKPOINT_VERSION;
+  head.size_of_double = (int)sizeof(double);
+  head.num_params = NUM_OF_PARAMS;
+  head.num_vertices = NUM_OF_VERTICES;
+  head.num_evals = num_evals;
+  get_rng_state(&head.seed, &head.rand_draws);
+  get_stall_state(&head.stall);
+
+  sprintf(tmp_name, "%s.tmp", CHECKPOINT_FILE);
+  out = fopen(tmp_name, "wb");
+  if (out == NULL) {
+    fprintf(stderr, "Cannot open checkpoint file=[%s]:[%s]\n", tmp_name, strerror(errno));
+    return 1;
+  }
+  ok = fwrite(&head, sizeof head, 1, out) == 1;
+  ok = ok && fwrite(&op[0][0], sizeof(double), (size_t)NUM_OF_VERTICES * NUM_OF_PARAMS, out)
+          == (size_t)NUM_OF_VERTICES * NUM_OF_PARAMS;
+  ok = ok && fwrite(mfv, sizeof(double), (size_t)NUM_OF_VERTICES, out) == (size_t)NUM_OF_VERTICES;
+  ok = ok && fwrite(psum, sizeof(double), (size_t)NUM_OF_PARAMS, out) == (size_t)NUM_OF_PARAMS;
+  ok = ok && !fflush(out);
+  ok = ok && !fsync(fileno(out));
+  ok = !fclose(out) && ok;
+  if (!ok) {
+    fprintf(stderr, "Cannot write checkpoint file=[%s]:[%s]\n", tmp_name, strerror(errno));
+    (void) remove(tmp_name);
+    return 1;
+  }
+  if (rename(tmp_name, CHECKPOINT_FILE)) {
+    fprintf(stderr, "Cannot rename [%s] to [%s]:[%s]\n",
+            tmp_name, CHECKPOINT_FILE, strerror(errno));
+    return 1;
+  }
+  return 0;
+}
+
+/****************************************************************
+FUNCTION: read_checkpoint
+DESCRIPTION: Restores the simplex and the random number generator
+state from CHECKPOINT_FILE. The checkpoint must have been written
+for the same number of parameters (i.e. the same model grid).
+INPUTS: (OUT) double op[][NUM_OF_PARAMS]  (the simplex vertices)
+        (OUT) double mfv[]  (minimizing function value at each vertex)
+        (OUT) double psum[]  (column sums of the simplex)
+        (OUT) int *num_evals  (number of function evaluations so far)
+OUTPUTS: int 1=error, 0=no error
+*****************************************************************/
+int read_checkpoint(double op[][NUM_OF_PARAMS], double mfv[], double psum[], int *num_evals) {
+
+  CHECKPOINT_HEADER head;
+  FILE *in;
+  int ok;
+
+  in = fopen(CHECKPOINT_FILE, "rb");
+  if (in == NULL) {
+    fprintf(stderr, "Cannot open checkpoint file=[%s]:[%s]\n", CHECKPOINT_FILE, strerror(errno));
+    return 1;
+  }
+  if (fread(&head, sizeof head, 1, in) != 1 ||
+      memcmp(head.magic, CHECKPOINT_MAGIC, sizeof head.magic) ||
+      head.version != CHECKPOINT_VERSION ||
+      head.size_of_double != (int)sizeof(double)) {
+    fprintf(stderr, "[%s] is not a version %d checkpoint file\n", CHECKPOINT_FILE, CHECKPOINT_VERSION);
+    fclose(in);
+    return 1;
+  }
+  if (head.num_params != NUM_OF_PARAMS || head.num_vertices != NUM_OF_VERTICES) {
+    fprintf(stderr, "Checkpoint [%s] has %d parameters, this model has %d\n",
+            CHECKPOINT_FILE, head.num_params, NUM_OF_PARAMS);
+    fclose(in);
+    return 1;
+  }
+  ok = fread(&op[0][0], sizeof(double), (size_t)NUM_OF_VERTICES * NUM_OF_PARAMS, in)
+         == (size_t)NUM_OF_VERTICES * NUM_OF_PARAMS;
+  ok = ok && fread(mfv, sizeof(double), (size_t)NUM_OF_VERTICES, in) == (size_t)NUM_OF_VERTICES;
+  ok = ok && fread(psum, sizeof(double), (size_t)NUM_OF_PARAMS, in) == (size_t)NUM_OF_PARAMS;
+  fclose(in);
+  if (!ok) {
+    fprintf(stderr, "Checkpoint file [%s] is truncated\n", CHECKPOINT_FILE);
+    return 1;
+  }
+  *num_evals = head.num_evals;
+  set_rng_state(head.seed, head.rand_draws);
+  set_stall_state(&head.stall);
+  return 0;
+}
@@ -0,0 +1,252 @@
+/*
+	 File Name:   collectives.c
+
+	 Program Name:  grav_parallel
+	 Subroutine Name(s): gatherv_long(), scatterv_long(), bcast_long(),
+	                     reduce_sum_long()
+	 Release Date:         April 1, 2020
+	 Release Version:      1.0
+
+	 VERSION/REVISION HISTORY
+
+	 MPI collectives with 64-bit counts.
+
+
+	 DISCLAIMER/NOTICE
+
+	 This computer code/material was prepared as an account of work
+	 performed by the Center for Nuclear Waste Regulatory Analyses (CNWRA)
+	 for the Division of Waste Management of the Nuclear Regulatory
+	 Commission (NRC), an independent agency of the United States
+	 Government. The developer(s) of the code nor any of their sponsors
+	 make any warranty, expressed or implied, or assume any legal
+	 liability or responsibility for the accuracy, completeness, or
+	 usefulness of any information, apparatus, product or process
+	 disclosed, or represent that its use would not infringe on
+	 privately-owned rights.
+
+	 IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW WILL THE SPONSORS
+	 OR THOSE WHO HAVE WRITTEN OR MODIFIED THIS CODE, BE LIABLE FOR
+	 DAMAGES, INCLUDING ANY LOST PROFITS, LOST MONIES, OR OTHER SPECIAL,
+	 INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+	 INABILITY TO USE (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+	 BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY THIRD PARTIES OR A
+	 FAILURE OF THE PROGRAM TO OPERATE WITH OTHER PROGRAMS) THE PROGRAM,
+	 EVEN IF YOU HAVE BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGES,
+	 OR FOR ANY CLAIM BY ANY OTHER PARTY.
+
+
+	 PURPOSE:
+	 The MPI collectives take int counts and displacements, which limits a
+	 single gather of the survey to INT_MAX points. These subroutines take long
+	 counts and displacements. When every count and displacement fits in
+	 an int they call the MPI collective directly; otherwise the data are
+	 moved in pieces of at most COLLECTIVE_CHUNK elements (point-to-point
+	 for the gather and scatter).
+
+	 PROGRAMMING LANGUAGE:  ANSI C
+
+	 GLOBAL VARIABLES:
+
+	 REFERENCES:
+
+	 PROGRAM FLOW:
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <mpi.h>
+#include "prototypes.h"
+
+/* the most elements moved by one MPI call */
+#ifndef COLLECTIVE_CHUNK
+#define COLLECTIVE_CHUNK INT_MAX
+#endif
+
+#define CHUNK_TAG 34
+
+/****************************************************************
+FUNCTION: fits_int
+DESCRIPTION: Decides, consistently on every process of <comm>,
+whether the counts and displacements of a gather or scatter fit the
+MPI int arguments. The counts and displacements are only looked at
+on the root; every process looks at its own count.
+INPUTS: (IN) long count  (this process's count)
+        (IN) long counts[], displs[]  (every process's, root only)
+        (IN) int root, MPI_Comm comm
+OUTPUTS: int 1=fits, 0=does not fit
+*****************************************************************/
+static int fits_int(long count, long counts[], long displs[], int root, MPI_Comm comm) {
+
+  int i, rank, size, fits, all;
+
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+  fits = count <= COLLECTIVE_CHUNK;
+  if (rank == root)
+    for (i = 0; i < size; i++)
+      if (counts[i] > COLLECTIVE_CHUNK || displs[i] > COLLECTIVE_CHUNK) fits = 0;
+  MPI_Allreduce(&fits, &all, 1, MPI_INT, MPI_LAND, comm);
+  return all;
+}
+
+/****************************************************************
+FUNCTION: to_int
+DESCRIPTION: Copies long counts or displacements into an int array
+(scratch buffer <which>, reused by the next call).
+INPUTS: (IN) long in[], int n
+        (IN) int which  (SCRATCH_COUNTS or SCRATCH_DISPLS)
+OUTPUTS: int *, the copy, or NULL on error
+*****************************************************************/
+static int *to_int(long in[], int n, int which) {
+
+  int i, *out;
+
+  out = (int *)scratch_buffer(which, (size_t)n * sizeof(int));
+  if (out == NULL) {
+    fprintf(stderr, "Cannot malloc memory for counts:[%s]\n", strerror(errno));
+    return NULL;
+  }
+  for (i = 0; i < n; i++) out[i] = (int)in[i];
+  return out;
+}
+
+/****************************************************************
+FUNCTION: gatherv_long
+DESCRIPTION: MPI_Gatherv with long counts and displacements (in
+elements of <type>).
+INPUTS: (IN) void *sendbuf, long sendcount
+        (OUT) void *recvbuf  (root only)
+        (IN) long counts[], displs[]  (root only)
+        (IN) MPI_Datatype type, int root, MPI_Comm comm
+OUTPUTS: int, MPI_SUCCESS or an MPI error code
+*****************************************************************/
+int gatherv_long(void *sendbuf, long sendcount, void *recvbuf,
+                 long counts[], long displs[], MPI_Datatype type, int root, MPI_Comm comm) {
+
+  int i, rank, size, ret = MPI_SUCCESS, *ct = NULL, *dp = NULL;
+  long off, n;
+  MPI_Aint lb, extent;
+
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+  if (fits_int(sendcount, counts, displs, root, comm)) {
+    if (rank == root && 
+        ((ct = to_int(counts, size, SCRATCH_COUNTS)) == NULL || (dp = to_int(displs, size, SCRATCH_DISPLS)) == NULL))
+      return MPI_ERR_NO_MEM;
+    return MPI_Gatherv(sendbuf, (int)sendcount, type, recvbuf, ct, dp, type, root, comm);
+  }
+
+  MPI_Type_get_extent(type, &lb, &extent);
+  if (rank != root) {
+    for (off = 0; off < sendcount && ret == MPI_SUCCESS; off += n) {
+      n = (sendcount - off < COLLECTIVE_CHUNK) ? sendcount - off : COLLECTIVE_CHUNK;
+      ret = MPI_Send((char *)sendbuf + off * extent, (int)n, type, root, CHUNK_TAG, comm);
+    }
+    return ret;
+  }
+  for (i = 0; i < size; i++)
+    for (off = 0; off < counts[i] && ret == MPI_SUCCESS; off += n) {
+      n = (counts[i] - off < COLLECTIVE_CHUNK) ? counts[i] - off : COLLECTIVE_CHUNK;
+      if (i == root)
+        ret = MPI_Sendrecv((char *)sendbuf + off * extent, (int)n, type, root, CHUNK_TAG,
+                           (char *)recvbuf + (displs[i] + off) * extent, (int)n, type, root, CHUNK_TAG,
+                           comm, MPI_STATUS_IGNORE);
+      else
+        ret = MPI_Recv((char *)recvbuf + (displs[i] + off) * extent, (int)n, type, i, CHUNK_TAG,
+                       comm, MPI_STATUS_IGNORE);
+    }
+  return ret;
+}
+
+/****************************************************************
+FUNCTION: scatterv_long
+DESCRIPTION: MPI_Scatterv with long counts and displacements (in
+elements of <type>).
+INPUTS: (IN) void *sendbuf  (root only)
+        (IN) long counts[], displs[]  (root only)
+        (OUT) void *recvbuf, (IN) long recvcount
+        (IN) MPI_Datatype type, int root, MPI_Comm comm
+OUTPUTS: int, MPI_SUCCESS or an MPI error code
+*****************************************************************/
+int scatterv_long(void *sendbuf, long counts[], long displs[], void *recvbuf,
+                  long recvcount, MPI_Datatype type, int root, MPI_Comm comm) {
+
+  int i, rank, size, ret = MPI_SUCCESS, *ct = NULL, *dp = NULL;
+  long off, n;
+  MPI_Aint lb, extent;
+
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+  if (fits_int(recvcount, counts, displs, root, comm)) {
+    if (rank == root && 
+        ((ct = to_int(counts, size, SCRATCH_COUNTS)) == NULL || (dp = to_int(displs, size, SCRATCH_DISPLS)) == NULL))
+      return MPI_ERR_NO_MEM;
+    return MPI_Scatterv(sendbuf, ct, dp, type, recvbuf, (int)recvcount, type, root, comm);
+  }
+
+  MPI_Type_get_extent(type, &lb, &extent);
+  if (rank != root) {
+    for (off = 0; off < recvcount && ret == MPI_SUCCESS; off += n) {
+      n = (recvcount - off < COLLECTIVE_CHUNK) ? recvcount - off : COLLECTIVE_CHUNK;
+      ret = MPI_Recv((char *)recvbuf + off * extent, (int)n, type, root, CHUNK_TAG,
+                     comm, MPI_STATUS_IGNORE);
+    }
+    return ret;
+  }
+  for (i = 0; i < size; i++)
+    for (off = 0; off < counts[i] && ret == MPI_SUCCESS; off += n) {
+      n = (counts[i] - off < COLLECTIVE_CHUNK) ? counts[i] - off : COLLECTIVE_CHUNK;
+      if (i == root)
+        ret = MPI_Sendrecv((char *)sendbuf + (displs[i] + off) * extent, (int)n, type, root, CHUNK_TAG,
+                           (char *)recvbuf + off * extent, (int)n, type, root, CHUNK_TAG,
+                           comm, MPI_STATUS_IGNORE);
+      else
+        ret = MPI_Send((char *)sendbuf + (displs[i] + off) * extent, (int)n, type, i, CHUNK_TAG, comm);
+    }
+  return ret;
+}
+
+/****************************************************************
+FUNCTION: bcast_long
+DESCRIPTION: MPI_Bcast with a long count.
+INPUTS: (IN/OUT) void *buf, (IN) long count
+        (IN) MPI_Datatype type, int root, MPI_Comm comm
+OUTPUTS: int, MPI_SUCCESS or an MPI error code
+*****************************************************************/
+int bcast_long(void *buf, long count, MPI_Datatype type, int root, MPI_Comm comm) {
+
+  int ret = MPI_SUCCESS;
+  long off, n;
+  MPI_Aint lb, extent;
+
+  MPI_Type_get_extent(type, &lb, &extent);
+  for (off = 0; off < count && ret == MPI_SUCCESS; off += n) {
+    n = (count - off < COLLECTIVE_CHUNK) ? count - off : COLLECTIVE_CHUNK;
+    ret = MPI_Bcast((char *)buf + off * extent, (int)n, type, root, comm);
+  }
+  return ret;
+}
+
+/****************************************************************
+FUNCTION: reduce_sum_long
+DESCRIPTION: MPI_Reduce (MPI_SUM of doubles) with a long count.
+The root may pass MPI_IN_PLACE as <sendbuf>.
+INPUTS: (IN) double *sendbuf, (OUT) double *recvbuf  (root only)
+        (IN) long count, int root, MPI_Comm comm
+OUTPUTS: int, MPI_SUCCESS or an MPI error code
+*****************************************************************/
+int reduce_sum_long(void *sendbuf, double *recvbuf, long count, int root, MPI_Comm comm) {
+
+  int ret = MPI_SUCCESS;
+  long off, n;
+
+  for (off = 0; off < count && ret == MPI_SUCCESS; off += n) {
+    n = (count - off < COLLECTIVE_CHUNK) ? count - off : COLLECTIVE_CHUNK;
+    ret = MPI_Reduce((sendbuf == MPI_IN_PLACE) ? MPI_IN_PLACE : (void *)((double *)sendbuf + off),
+                     recvbuf + off, (int)n, MPI_DOUBLE, MPI_SUM, root, comm);
+  }
+  return ret;
+}
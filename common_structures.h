@@ -47,18 +47,19 @@ typedef struct point
   double elev;  /* elevation of a location */
   double observed; /* the measured value at this location */
   double calculated; /* the calculated value at this location */
+  double fixed; /* field of the prisms outside the mask (this node's block of them), per unit density */
+  double best; /* the calculated value of the best model evaluated so far (see keep_best()) */
 } POINT;
 
-/* properties of a single prism */
+/* outline of a single prism; these never change during the inversion
+   (the surface to bottom distance of each prism is kept separately) */
 typedef struct prism{
   /* boundaries of the prism w.r.t. the coordinate system being used, in meters */
   double south; /*south_edge*/ 
   double north; /*north_edge*/
   double west; /*west_edge*/
   double east; /*east_edge*/
-	/* surface to bottom distance for a prism (meters)*/
-  double depth_to_bottom; /*depth_to_bottom*/
-  int b; /* border cell, b=0 or b=1, b=1 means it is a border cell */
+  int b; /* CELL_MASKED = outside MASK_FILE, 0 = otherwise (the border is found by position) */
 } PRISM;
 
 /* the model parameters */
@@ -77,6 +78,37 @@ typedef struct parameter{
 	int Npoints; /* the total number of points used to create the individuals (row * col)*/
 } PARAMETER;
 
+/* progress bookkeeping used to detect a stalled simplex */
+typedef struct stall {
+  double best; /* best minimizing function value at the last progress check */
+  int start; /* number of function evaluations at the last progress check */
+  int rebuilds; /* number of times the simplex has been rebuilt */
+} STALL;
+
+/* start of a binary survey file; the columns (arrays of count doubles,
+   see SURVEY_EASTING ... SURVEY_OBSERVED) follow at column_offset[] */
+typedef struct survey_header {
+  char magic[8]; /* SURVEY_MAGIC, not null terminated */
+  int version; /* SURVEY_VERSION */
+  int byte_order; /* SURVEY_BYTE_ORDER */
+  int num_columns; /* SURVEY_COLUMNS */
+  int size_of_double;
+  long count; /* number of points */
+  double min_easting, max_easting; /* bounds of the survey */
+  double min_northing, max_northing;
+  long column_offset[SURVEY_COLUMNS]; /* byte offset of each column from the start of the file */
+  char column_name[SURVEY_COLUMNS][16];
+} SURVEY_HEADER;
+
+/* a copy of the best model and its calculated field, for the output writer */
+typedef struct snapshot {
+  double fit; /* RMSE of the model */
+  double depth_to_top;
+  double density;
+  double *bottom; /* depth to the bottom of each prism */
+  double *calculated; /* calculated value at each point, in the order of the master's points */
+} SNAPSHOT;
+
 typedef struct inputs {
   char *points_file;
 } INPUTS;
@@ -1,7 +1,18 @@
 #include <math.h>
 #include <stdio.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "prototypes.h"
 
+/* Threads share the prism loop only when a large grid is evaluated outside
+   of an already threaded loop over the points */
+#ifdef _OPENMP
+#define THREAD_PRISMS(n) ((n) >= THREAD_MIN_PRISMS && !omp_in_parallel())
+#else
+#define THREAD_PRISMS(n) 0
+#endif
+
 #define gamma 6.670e-11L
 #define twopi 6.2831853L
 #define si2mg 1.0e5L
@@ -11,7 +22,7 @@
 
 
 /* double gbox(double *x0,double *y0,double *z0, double *x1,double *y1,double *z1,double *x2,double *y2,double *z2,double *rho) { */
-double gbox(POINT *pt, PRISM *pr, PARAMETER *pa) { 
+double gbox(POINT *pt, PRISM *pr, const double *param, const int *index, PARAMETER *pa) { 
   /*
     Function gbox computes the vertical attraction of a 
     rectangular prism.  Sides of prism are parallel to x,y,z axes,
@@ -33,13 +44,20 @@ double gbox(POINT *pt, PRISM *pr, PARAMETER *pa) {
    
    *  south_edge, north_edge  represent the length of the prism in meters 
    *  west_edge, east_edge  represent the width of the prism in meters
-   *  surf_to_top and surf_to_bot represent the depth of the prism in meters
+   *  surf_to_top (pa->depth_to_top) and surf_to_bot (param[index[i]]) represent the depth of the prism in meters
+   *  (param is the parameter vector itself, see create_index())
    *  density is the rock density of the prism
    *
    
     Output parameters:
     Vertical attraction of gravity, g, in mGal, summed over all prisms in the model. 
+    A prism whose bottom is at its top (e.g. a border cell) attracts nothing and
+    is skipped. The field of the prisms outside the mask, pt->fixed per unit
+    density, is added.
     
+    For a large grid (THREAD_MIN_PRISMS prisms or more) called outside a threaded
+    loop, the prisms are shared among the OpenMP threads; the sum is then
+    accumulated in a different order than the serial loop.
   */
   int i;
   int x,y,z;
@@ -50,8 +68,16 @@ double gbox(POINT *pt, PRISM *pr, PARAMETER *pa) {
   double g = 0;
   /*(void) fprintf (stderr, "In gbox\n"); */
   
+  isign[0] = -1.0;
+  isign[1] = 1.0;
+  
+#pragma omp parallel for schedule(static) reduction(+:g) \
+  private(x, y, z, sum, rijk, ijk, arg1, arg2, arg3, xs, ys, zs) \
+  if (THREAD_PRISMS(pa->N_units))
   for (i=0; i < pa->N_units; i++) {
   
+    if (param[index[i]] == pa->depth_to_top) continue;
+    
     /* (void) fprintf (stderr, "%f %f %f %f %f %f %f\n", *x0, *y0, *z0, *x1, *y1, *z1, *rho);*/
     /* xs[0] = *x0 - *x1; */
     xs[0] = pt->easting - (pr+i)->west;
@@ -69,10 +95,8 @@ double gbox(POINT *pt, PRISM *pr, PARAMETER *pa) {
     ys[1] = pt->northing - (pr+i)->north;
   
     /* zs[1] = *z0 - *z2; */
-    zs[1] = pt->elev - (pr+i)->depth_to_bottom;
+    zs[1] = pt->elev - param[index[i]];
   
-    isign[0] = -1.0;
-    isign[1] = 1.0;
     /*(void) fprintf (stderr, "%lf %lf %lf %lf %lf %lf %lf\n", xs[0], xs[1], ys[0], ys[1], zs[0], zs[1], *rho  );*/
   
   
@@ -98,7 +122,80 @@ double gbox(POINT *pt, PRISM *pr, PARAMETER *pa) {
     /*g += (pa->density * sum * G_TEMP); */
     g += sum;
   }
-  g *=  G_TEMP_x_DENSITY(pa->density);
+  g = g * G_TEMP_x_DENSITY(pa->density) + pt->fixed * pa->density;
   return g;
 }
 
+
+/* Batched form of gbox(): the vertical attraction at one observation point
+   for K candidate models at once. */
+void gbox_batch(POINT *pt, PRISM *pr, PARAMETER *pa, int K,
+                const double *params, int stride, const int *index, double *g) {
+  /*
+    The candidates share the prism outlines, so the horizontal offsets of the
+    point from each prism are computed once and reused for all K models.
+
+    Input parameters:
+    pt, pr, pa as for gbox(); pa->N_units prisms are summed.
+    K is the number of candidate models.
+    params + k * stride is the parameter vector of candidate k: its depth to
+    the top of the prisms, its rock density, and the depth to the bottom of
+    prism i at params[k * stride + index[i]] (see create_index()).
+
+    Output parameters:
+    g[k], the vertical attraction of gravity in mGal for candidate k.
+    For each candidate the result is identical to gbox(); zero-thickness
+    prisms are skipped in the same way.
+  */
+  int i, k;
+  int x,y,z;
+  double sum;
+  double rijk, ijk;
+  double arg1, arg2, arg3;
+  double xs[2],ys[2],zs[2],isign[2];
+  double xy2[2][2]; /* xs*xs + ys*ys, the horizontal part of rijk */
+
+  isign[0] = -1.0;
+  isign[1] = 1.0;
+  for (k=0; k < K; k++) g[k] = 0.0;
+
+  for (i=0; i < pa->N_units; i++) {
+    /* a border cell has zero thickness in every candidate */
+    if (index[i] == DEPTH_TO_TOP) continue;
+    xs[0] = pt->easting - (pr+i)->west;
+    ys[0] = pt->northing - (pr+i)->south;
+    xs[1] = pt->easting - (pr+i)->east;
+    ys[1] = pt->northing - (pr+i)->north;
+    for (x=0; x<2; x++)
+      for (y=0; y<2; y++)
+        xy2[x][y] = xs[x]*xs[x] + ys[y]*ys[y];
+
+    for (k=0; k < K; k++) {
+      if (params[k * stride + index[i]] == params[k * stride + DEPTH_TO_TOP]) continue;
+      zs[0] = pt->elev - params[k * stride + DEPTH_TO_TOP];
+      zs[1] = pt->elev - params[k * stride + index[i]];
+
+      sum=0.0;
+      for (x=0; x<2; x++) {
+        for (y=0; y<2; y++) {
+          for (z=0; z<2; z++) {
+	         rijk = sqrt(xy2[x][y] + zs[z]*zs[z]);
+	         ijk = isign[x]*isign[y]*isign[z];
+	         arg1 = atan2((xs[x]*ys[y]),(zs[z]*rijk));
+	         if (arg1 < 0.0) arg1 = arg1 + twopi;
+	         arg2 = rijk+ys[y];
+	         arg3 = rijk+xs[x];
+	         if(arg2 <= 0.0) arg2 = SMALL;
+	         if (arg3 <= 0.0) arg3 = SMALL;
+	         arg2 = log(arg2);
+	         arg3 = log(arg3);
+	         sum += ijk*(zs[z]*arg1-xs[x]*arg2-ys[y]*arg3);
+          }
+        }
+      }
+      g[k] += sum;
+    }
+  }
+  for (k=0; k < K; k++)
+    g[k] = g[k] * G_TEMP_x_DENSITY(params[k * stride + DENSITY]) + pt->fixed * params[k * stride + DENSITY];
+}
@@ -43,7 +43,8 @@
 	 the forward solution proposed by Rao and Babu (1991, Geophysics).
 	 
 	 b) Solves for the forward solution at many grid points using parallel
-	 programming techniques and MPI (Message Passing Interface).
+	 programming techniques and MPI (Message Passing Interface), with OpenMP
+	 threads sharing the work within each node.
 	 
 	 c) Compares observed and calculated gravity anomalies using standard
 	 goodness-of-fit measures (i.e., chi-squared, rmse)
@@ -60,7 +61,8 @@
 	 
 	 PROGRAMMING LANGUAGE:  ANSI C 
 	 
-	 USAGE: mpirun -np <number of processors> grav_parallel <configuration file> <data input file>
+	 USAGE: mpirun -np <number of processors> grav_parallel <configuration file> [--restart]
+	        (set OMP_NUM_THREADS for the number of threads on each node)
 	 
 	 GLOBAL VARIABLES:
 	 NUM_OF_PARAMS : an integer,  the number of prism parameters that will be simultaneously modelled
@@ -71,6 +73,29 @@
                 with the observed gravity values, all fall within the range of this value
 	 _LO[LAST_PARAM] :  an array of the minimum parameter values
 	 _HI[LAST_PARAM] :  an array of the maximum parameter values
+	 CHECKPOINT_INTERVAL : the number of function evaluations between checkpoints of the simplex
+	 CHECKPOINT_FILE : the name of the checkpoint file
+	 RESTART : if non-zero, the inversion resumes from the checkpoint file (--restart)
+	 ADAPTIVE_SIMPLEX : if non-zero, the simplex coefficients are scaled with NUM_OF_PARAMS
+	 STALL_EVALS, STALL_TOLERANCE, REBUILD_STEP : the simplex is rebuilt around the best vertex
+	                when the best value improves by less than STALL_TOLERANCE over STALL_EVALS evaluations
+	 BATCH_SIZE : the maximum number of parameter sets evaluated together (e.g. when the simplex shrinks)
+	 REBALANCE_INTERVAL : the number of evaluations between repartitions of the points by node speed
+	 PRISM_BLOCKS : the number of blocks the prisms are divided into; the nodes form a grid of
+	                point groups by prism blocks (see setup_process_grid())
+	 NONBLOCKING : 1 = the master calculates while the parameters are broadcast, and the slave nodes
+	                do not wait for the misfit reduction; 0 = every node waits for both
+	 HILBERT_ORDER : 1 = the points are ordered along a Hilbert curve, so each node's points are close together
+	 LOG_LEVEL : 0 = only summaries in the master's log, 1 = normal, 2 = debugging (e.g. every prism)
+	 OUTPUT_FORMAT : text, or binary (a float grid of the prism bottoms, and the calculated field
+	                written in parallel by the nodes with MPI-IO)
+	 STREAM_POINTS : 0 = every node keeps its points in memory; N = a node with more than N points
+	                reads them from the binary survey file N at a time, for every evaluation
+	 MASK_FILE : a polygon; only the interior prisms inside it are inverted (see mask.c)
+	 MASK_DEPTH : the depth to bottom of the prisms outside the mask (default: the depth to
+	                top, i.e. they have no thickness)
+	 PARAMETERIZATION : prisms = one depth to bottom parameter per free prism; bspline = the
+	                BASIS_ROWS by BASIS_COLS control values of a smooth bottom surface (see basis.c)
 
 	 REFERENCES: 
 	 
@@ -92,6 +117,26 @@
 int NUM_OF_PARAMS = 0;
 int NUM_OF_VERTICES = 1;
 double TOLERANCE = 1.0e-2;
+int CHECKPOINT_INTERVAL = 0; /* function evaluations between checkpoints, 0 = only on SIGTERM */
+char CHECKPOINT_FILE[MAX_FILENAME] = CHECKPOINT;
+int RESTART = 0; /* 1 = resume the inversion from CHECKPOINT_FILE */
+int ADAPTIVE_SIMPLEX = 0; /* 1 = dimension-adaptive simplex coefficients */
+int STALL_EVALS = 0; /* evaluations per progress check, 0 = never rebuild the simplex */
+double STALL_TOLERANCE = 1.0e-3; /* minimum relative improvement per progress check */
+double REBUILD_STEP = 0.1; /* rebuilt simplex size, fraction of each parameter range */
+int BATCH_SIZE = 8; /* parameter sets evaluated together in one pass over the points */
+int REBALANCE_INTERVAL = 0; /* evaluations between repartitions of the points, 0 = never */
+int PRISM_BLOCKS = 1; /* nodes sharing each block of points, each with its own block of prisms */
+int NONBLOCKING = 1; /* overlap the parameter broadcast and the misfit reduction with calculation */
+int HILBERT_ORDER = 0; /* 1 = order and divide the points along a Hilbert curve */
+int OUTPUT_FORMAT = OUTPUT_TEXT; /* format of the model and calculated field files */
+int LOG_LEVEL = LOG_INFO; /* most detailed log messages written */
+int STREAM_POINTS = 0; /* points held in memory per node at a time, 0 = all of them */
+char MASK_FILE[MAX_FILENAME] = ""; /* polygon around the prisms to invert, "" = all of them */
+double MASK_DEPTH = HUGE_VAL; /* depth to bottom of the prisms outside the mask, HUGE_VAL = the depth to top */
+int PARAMETERIZATION = PARAM_PRISMS; /* what the depth to bottom parameters are */
+int BASIS_ROWS = 4; /* control values of the bottom surface, north to south (PARAM_BSPLINE) */
+int BASIS_COLS = 4; /* control values of the bottom surface, west to east (PARAM_BSPLINE) */
 /*
 int ROWS = 1;
 int COLS = 1;
@@ -124,28 +169,34 @@ Outputs: 3 files,
 int main(int argc, char *argv[]) {
  
   char log_name[25];
-  double quit = 0.0;
-  int i;
   int my_rank; /* process rank of each node (local) */
   int procs; /* number of nodes used for processing */
+  int thread_level; /* level of thread support provided by MPI */
   double chi;
   INPUTS In;
 
-  /* Start up MPI */
-  MPI_Init(&argc, &argv);
+  /* Start up MPI; only the main thread of each node makes MPI calls,
+     the OpenMP threads share the point and prism loops */
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &thread_level);
 
    /* Get my process rank, an integer */
   MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+  if (!my_rank && thread_level < MPI_THREAD_FUNNELED)
+    fprintf(stderr, "Warning: this MPI library does not support threads (level %d)\n", thread_level);
 
 	/* Check for correct number of comand line arguments */
-  if (argc < 2 || argc > 2) {
+  if (argc == 3 && !strcmp(argv[2], "--restart")) RESTART = 1;
+  else if (argc != 2) {
     if (!my_rank)
       fprintf(stderr, 
-	      " Check comand line arguments,\nUSAGE: %s <config file>\n\n", argv[0]);
+	      " Check comand line arguments,\nUSAGE: %s <config file> [--restart]\n\n", argv[0]);
     MPI_Finalize();
     return(0);
   }
 
+  /* A preempted job gets a SIGTERM; catch it so the master can checkpoint */
+  install_signal_handlers();
+
   /* Find out how many processes are being used */
   MPI_Comm_size(MPI_COMM_WORLD, &procs);
   
@@ -160,6 +211,7 @@ int main(int argc, char *argv[]) {
 	    MPI_Finalize();
     return(0);
   }
+  log_init(log_file);
   set_LOG(log_file);
   
   /* Initialize */
@@ -214,15 +266,24 @@ int main(int argc, char *argv[]) {
   else { /* master */ 
     chi = master(); 
 
-    /* Send all slaves a quitin' time signal (i.e. a single zero value */
-    for ( i = 1; i < procs; i++ )
-      MPI_Send((void *)&quit, 1, MPI_DOUBLE, i, 0, MPI_COMM_WORLD);
+    /* Send all slaves a quitin' time signal */
+    send_command(CMD_QUIT, 0);
 
 		/* The Master node prints out a README file listing some input parameters and changed values */
+		phase_begin(PHASE_OUTPUT);
 		printout_parameters(chi);
+		phase_end();
 
   } /* end master code */
 
+  /* Every node's time in each phase goes to PERFORMANCE_REPORT */
+  (void) write_report();
+
+  /* Every node's idle fraction and memory go to the master's log file */
+  report_idle();
+  log_summary("%lu allocations, %lu bytes held", arena_allocations(), (unsigned long)arena_held());
+  shared_free();
+  arena_release();
   (void) fclose(log_file);
   MPI_Finalize();
   return(0);
@@ -0,0 +1,166 @@
+/*
+	 File Name:   hilbert.c
+
+	 Program Name:  grav_parallel
+	 Subroutine Name(s): hilbert_key(), hilbert_sort()
+	 Release Date:         April 1, 2020
+	 Release Version:      1.0
+
+	 VERSION/REVISION HISTORY
+
+	 Spatial ordering of the observation points.
+
+
+	 DISCLAIMER/NOTICE
+
+	 This computer code/material was prepared as an account of work
+	 performed by the Center for Nuclear Waste Regulatory Analyses (CNWRA)
+	 for the Division of Waste Management of the Nuclear Regulatory
+	 Commission (NRC), an independent agency of the United States
+	 Government. The developer(s) of the code nor any of their sponsors
+	 make any warranty, expressed or implied, or assume any legal
+	 liability or responsibility for the accuracy, completeness, or
+	 usefulness of any information, apparatus, product or process
+	 disclosed, or represent that its use would not infringe on
+	 privately-owned rights.
+
+	 IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW WILL THE SPONSORS
+	 OR THOSE WHO HAVE WRITTEN OR MODIFIED THIS CODE, BE LIABLE FOR
+	 DAMAGES, INCLUDING ANY LOST PROFITS, LOST MONIES, OR OTHER SPECIAL,
+	 INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+	 INABILITY TO USE (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+	 BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY THIRD PARTIES OR A
+	 FAILURE OF THE PROGRAM TO OPERATE WITH OTHER PROGRAMS) THE PROGRAM,
+	 EVEN IF YOU HAVE BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGES,
+	 OR FOR ANY CLAIM BY ANY OTHER PARTY.
+
+
+	 PURPOSE:
+	 The points are reordered along a Hilbert curve laid over the survey,
+	 so that points that are close together on the ground are close
+	 together in memory, and each node's contiguous range of points
+	 (a segment of the curve) covers a compact patch of the survey.
+
+	 PROGRAMMING LANGUAGE:  ANSI C
+
+	 GLOBAL VARIABLES:
+
+	 REFERENCES: 
+	 Hilbert, D., 1891, Ueber die stetige Abbildung einer Linie auf ein
+	 Flaechenstueck, Mathematische Annalen, v. 38, p. 459-460.
+
+	 PROGRAM FLOW:
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "prototypes.h"
+
+/* the survey is covered by a HILBERT_SIDE x HILBERT_SIDE grid of cells */
+#define HILBERT_BITS 16
+#define HILBERT_SIDE (1UL << HILBERT_BITS)
+
+/* a point's position along the curve, and its position in the file */
+typedef struct hilbert_entry {
+  unsigned long key;
+  long index;
+} HILBERT_ENTRY;
+
+/****************************************************************
+FUNCTION: hilbert_key
+DESCRIPTION: The distance along the Hilbert curve of the cell (x, y)
+of a HILBERT_SIDE x HILBERT_SIDE grid.
+INPUTS: (IN) unsigned long x, y  (the cell, 0 to HILBERT_SIDE-1)
+OUTPUTS: unsigned long, the distance along the curve
+*****************************************************************/
+unsigned long hilbert_key(unsigned long x, unsigned long y) {
+
+  unsigned long s, rx, ry, t, d = 0;
+
+  for (s = HILBERT_SIDE / 2; s > 0; s /= 2) {
+    rx = (x & s) > 0;
+    ry = (y & s) > 0;
+    d += s * s * ((3 * rx) ^ ry);
+    /* rotate the quadrant so the curve stays continuous */
+    if (ry == 0) {
+      if (rx == 1) {
+        x = s - 1 - x;
+        y = s - 1 - y;
+      }
+      t = x;
+      x = y;
+      y = t;
+    }
+  }
+  return d;
+}
+
+/****************************************************************
+FUNCTION: compare_entries
+DESCRIPTION: qsort() comparison: by position along the curve, then
+by position in the file, so the order is the same on every platform.
+*****************************************************************/
+static int compare_entries(const void *a, const void *b) {
+
+  const HILBERT_ENTRY *ea = (const HILBERT_ENTRY *)a;
+  const HILBERT_ENTRY *eb = (const HILBERT_ENTRY *)b;
+
+  if (ea->key != eb->key) return (ea->key < eb->key) ? -1 : 1;
+  return (ea->index < eb->index) ? -1 : (ea->index > eb->index);
+}
+
+/****************************************************************
+FUNCTION: hilbert_sort
+DESCRIPTION: Reorders the points along a Hilbert curve over their
+bounding box (easting, northing).
+INPUTS: (IN/OUT) POINT *p  (the points)
+        (IN) long n  (number of points)
+        (OUT) long place[]  (new position of the point that was at 
+                             position i in the file)
+OUTPUTS: int 1=error, 0=no error
+*****************************************************************/
+int hilbert_sort(POINT *p, long n, long place[]) {
+
+  HILBERT_ENTRY *entry;
+  POINT *copy;
+  double min_e, max_e, min_n, max_n, scale_e, scale_n;
+  long i;
+
+  if (n <= 0) return 0;
+  entry = (HILBERT_ENTRY *)temp_alloc((size_t)n * sizeof(HILBERT_ENTRY));
+  copy = (POINT *)temp_alloc((size_t)n * sizeof(POINT));
+  if (entry == NULL || copy == NULL) {
+    fprintf(stderr, "Cannot malloc memory to sort %ld points:[%s]\n", n, strerror(errno));
+    temp_free(entry);
+    temp_free(copy);
+    return 1;
+  }
+
+  min_e = max_e = p->easting;
+  min_n = max_n = p->northing;
+  for (i = 1; i < n; i++) {
+    if ((p+i)->easting < min_e) min_e = (p+i)->easting;
+    if ((p+i)->easting > max_e) max_e = (p+i)->easting;
+    if ((p+i)->northing < min_n) min_n = (p+i)->northing;
+    if ((p+i)->northing > max_n) max_n = (p+i)->northing;
+  }
+  scale_e = (max_e > min_e) ? (HILBERT_SIDE - 1) / (max_e - min_e) : 0.0;
+  scale_n = (max_n > min_n) ? (HILBERT_SIDE - 1) / (max_n - min_n) : 0.0;
+
+  for (i = 0; i < n; i++) {
+    entry[i].key = hilbert_key((unsigned long)(((p+i)->easting - min_e) * scale_e),
+                               (unsigned long)(((p+i)->northing - min_n) * scale_n));
+    entry[i].index = i;
+  }
+  qsort(entry, (size_t)n, sizeof(HILBERT_ENTRY), compare_entries);
+
+  memcpy(copy, p, (size_t)n * sizeof(POINT));
+  for (i = 0; i < n; i++) {
+    p[i] = copy[entry[i].index];
+    place[entry[i].index] = i;
+  }
+  temp_free(entry);
+  temp_free(copy);
+  return 0;
+}
@@ -0,0 +1,142 @@
+/*
+	 File Name:   log.c
+
+	 Program Name:  grav_parallel
+	 Subroutine Name(s): log_init(), log_msg(), log_summary(), log_elapsed()
+	 Release Date:         April 1, 2020
+	 Release Version:      1.0
+
+	 VERSION/REVISION HISTORY
+
+	 Leveled, buffered logging.
+
+	 DISCLAIMER/NOTICE
+
+	 This computer code/material was prepared as an account of work
+	 performed by the Center for Nuclear Waste Regulatory Analyses (CNWRA)
+	 for the Division of Waste Management of the Nuclear Regulatory
+	 Commission (NRC), an independent agency of the United States
+	 Government. The developer(s) of the code nor any of their sponsors
+	 make any warranty, expressed or implied, or assume any legal
+	 liability or responsibility for the accuracy, completeness, or
+	 usefulness of any information, apparatus, product or process
+	 disclosed, or represent that its use would not infringe on
+	 privately-owned rights.
+
+	 IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW WILL THE SPONSORS
+	 OR THOSE WHO HAVE WRITTEN OR MODIFIED THIS CODE, BE LIABLE FOR
+	 DAMAGES, INCLUDING ANY LOST PROFITS, LOST MONIES, OR OTHER SPECIAL,
+	 INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+	 INABILITY TO USE (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+	 BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY THIRD PARTIES OR A
+	 FAILURE OF THE PROGRAM TO OPERATE WITH OTHER PROGRAMS) THE PROGRAM,
+	 EVEN IF YOU HAVE BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGES,
+	 OR FOR ANY CLAIM BY ANY OTHER PARTY.
+
+
+	 PURPOSE:
+	 Every node writes its own log file (node_N). The log is fully
+	 buffered, so that writing it does not cost a system call per line,
+	 and each message has a level: LOG_SUMMARY messages are always
+	 written, LOG_INFO messages unless LOG_LEVEL is 0, and LOG_DEBUG
+	 messages (e.g. one line per prism) only when LOG_LEVEL is 2.
+	 log_summary() collects one line from every node into the master's
+	 log, so that the per-node details of a large job can be read in one
+	 place instead of hundreds of files.
+
+	 PROGRAMMING LANGUAGE:  ANSI C
+
+	 GLOBAL VARIABLES:
+
+	 LOG_LEVEL : LOG_SUMMARY (0), LOG_INFO (1) or LOG_DEBUG (2)
+
+	 REFERENCES:
+
+	 PROGRAM FLOW:
+	 log_init() as soon as the log file is open, before anything is
+	 written to it.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "prototypes.h"
+
+#define LOG_BUFFER (1 << 20) /* bytes of log buffered before they are written */
+#define SUMMARY_CHARS 160 /* longest line of a summary */
+
+static FILE *log_out = NULL;
+static char log_buffer[LOG_BUFFER];
+static double clock_start = 0.0; /* when log_init() was called */
+
+/****************************************************************
+FUNCTION: log_init
+DESCRIPTION: Buffers this node's log file and starts the clock for
+log_elapsed().
+INPUTS: (IN) FILE *log  (this node's log file, nothing written yet)
+OUTPUTS: none
+*****************************************************************/
+void log_init(FILE *log) {
+
+  clock_start = MPI_Wtime();
+  log_out = log;
+  (void) setvbuf(log, log_buffer, _IOFBF, LOG_BUFFER);
+}
+
+/****************************************************************
+FUNCTION: log_msg
+DESCRIPTION: Writes a message to this node's log file, if its level
+is at most LOG_LEVEL.
+INPUTS: (IN) int level  (LOG_SUMMARY, LOG_INFO or LOG_DEBUG)
+        (IN) const char *format, ...  (as for printf())
+OUTPUTS: none
+*****************************************************************/
+void log_msg(int level, const char *format, ...) {
+
+  va_list args;
+
+  if (log_out == NULL || level > LOG_LEVEL) return;
+  va_start(args, format);
+  (void) vfprintf(log_out, format, args);
+  va_end(args);
+}
+
+/****************************************************************
+FUNCTION: log_summary
+DESCRIPTION: Every node formats one line; the master writes all of
+them, labelled by node, to its log. At LOG_DEBUG each node also writes
+its own line to its own log. Called by every node.
+INPUTS: (IN) const char *format, ...  (as for printf(), no newline)
+OUTPUTS: none
+*****************************************************************/
+void log_summary(const char *format, ...) {
+
+  char line[SUMMARY_CHARS];
+  char *all = NULL;
+  va_list args;
+  int i, rank, procs;
+
+  va_start(args, format);
+  (void) vsnprintf(line, sizeof line, format, args);
+  va_end(args);
+  
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &procs);
+  if (rank && LOG_LEVEL >= LOG_DEBUG) log_msg(LOG_DEBUG, "%s\n", line);
+  if ( !rank ) all = (char *)malloc((size_t)procs * SUMMARY_CHARS);
+  MPI_Gather(line, SUMMARY_CHARS, MPI_BYTE, all, SUMMARY_CHARS, MPI_BYTE, 0, MPI_COMM_WORLD);
+  if ( !rank && all != NULL ) {
+    for (i = 0; i < procs; i++) log_msg(LOG_SUMMARY, "[node %d] %s\n", i, all + (size_t)i * SUMMARY_CHARS);
+    free(all);
+  }
+}
+
+/****************************************************************
+FUNCTION: log_elapsed
+DESCRIPTION: Seconds since log_init() (i.e. since the run started).
+INPUTS: none
+OUTPUTS: double, the seconds
+*****************************************************************/
+double log_elapsed(void) {
+  return MPI_Wtime() - clock_start;
+}
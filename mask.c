@@ -0,0 +1,183 @@
+/*
+	 File Name:   mask.c
+
+	 Program Name:  grav_parallel
+	 Subroutine Name(s): mask_prisms()
+	 Release Date:         April 1, 2020
+	 Release Version:      1.0
+
+	 VERSION/REVISION HISTORY
+
+	 Active region of the model grid.
+
+
+	 DISCLAIMER/NOTICE
+
+	 This computer code/material was prepared as an account of work
+	 performed by the Center for Nuclear Waste Regulatory Analyses (CNWRA)
+	 for the Division of Waste Management of the Nuclear Regulatory
+	 Commission (NRC), an independent agency of the United States
+	 Government. The developer(s) of the code nor any of their sponsors
+	 make any warranty, expressed or implied, or assume any legal
+	 liability or responsibility for the accuracy, completeness, or
+	 usefulness of any information, apparatus, product or process
+	 disclosed, or represent that its use would not infringe on
+	 privately-owned rights.
+
+	 IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW WILL THE SPONSORS
+	 OR THOSE WHO HAVE WRITTEN OR MODIFIED THIS CODE, BE LIABLE FOR
+	 DAMAGES, INCLUDING ANY LOST PROFITS, LOST MONIES, OR OTHER SPECIAL,
+	 INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+	 INABILITY TO USE (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+	 BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY THIRD PARTIES OR A
+	 FAILURE OF THE PROGRAM TO OPERATE WITH OTHER PROGRAMS) THE PROGRAM,
+	 EVEN IF YOU HAVE BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGES,
+	 OR FOR ANY CLAIM BY ANY OTHER PARTY.
+
+
+	 PURPOSE:
+	 A basin seldom fills the rectangle of the model grid. MASK_FILE is a
+	 polygon around the part of the grid to be inverted: only the interior
+	 prisms whose centers are inside it are parameters of the simplex. The
+	 others are fixed at MASK_DEPTH, and their field is calculated once
+	 (see fixed_field() in minimizing_func_new.c).
+
+	 The polygon file has one vertex per line, easting then northing; the
+	 polygon is closed from the last vertex back to the first. Lines
+	 starting with '#' are comments.
+
+	 PROGRAMMING LANGUAGE:  ANSI C
+
+	 GLOBAL VARIABLES:
+
+	 MASK_FILE : the polygon file, "" = every prism is inverted
+
+	 REFERENCES:
+
+	 PROGRAM FLOW:
+	 mask_prisms() once, by every process, after the grid size is known.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <mpi.h>
+#include "prototypes.h"
+
+#define MASK_LINE 200
+
+/****************************************************************
+FUNCTION: read_polygon
+DESCRIPTION: Reads the vertices of the MASK_FILE polygon. Only the
+master reads the file; the vertices are broadcast to the other
+processes.
+INPUTS: (OUT) int *n  (number of vertices)
+OUTPUTS: double *, easting and northing of each vertex (free()
+when done), or NULL on error
+*****************************************************************/
+static double *read_polygon(int *n) {
+
+  FILE *in;
+  char line[MASK_LINE];
+  double *vert = NULL, *more, x, y;
+  int rank, cap = 0;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  *n = 0;
+  if ( !rank ) {
+    in = fopen(MASK_FILE, "r");
+    if (in == NULL) {
+      fprintf(stderr, "Cannot open mask file=[%s]:[%s]\n", MASK_FILE, strerror(errno));
+      *n = -1;
+    }
+    else {
+      while (*n >= 0 && fgets(line, MASK_LINE, in) != NULL) {
+        if (line[0] == '#' || sscanf(line, "%lf %lf", &x, &y) != 2) continue;
+        if (*n == cap) {
+          cap = cap ? 2 * cap : 64;
+          more = (double *)realloc(vert, (size_t)cap * 2 * sizeof(double));
+          if (more == NULL) {
+            fprintf(stderr, "Cannot malloc memory for the mask:[%s]\n", strerror(errno));
+            *n = -1;
+            break;
+          }
+          vert = more;
+        }
+        vert[2 * *n] = x;
+        vert[2 * *n + 1] = y;
+        (*n)++;
+      }
+      fclose(in);
+      if (*n >= 0 && *n < 3) {
+        fprintf(stderr, "Mask file [%s] has %d vertices, a polygon needs 3\n", MASK_FILE, *n);
+        *n = -1;
+      }
+    }
+  }
+  MPI_Bcast(n, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  if (*n < 0) {
+    free(vert);
+    return NULL;
+  }
+  if (rank) vert = (double *)malloc((size_t)*n * 2 * sizeof(double));
+  if (vert == NULL) {
+    fprintf(stderr, "Cannot malloc memory for the mask:[%s]\n", strerror(errno));
+    return NULL;
+  }
+  if (bcast_long(vert, 2L * *n, MPI_DOUBLE, 0, MPI_COMM_WORLD)) {
+    fprintf(stderr, "Cannot receive the mask\n");
+    free(vert);
+    return NULL;
+  }
+  return vert;
+}
+
+/****************************************************************
+FUNCTION: inside
+DESCRIPTION: Reports whether a location is inside a polygon (even-
+odd rule: a ray from the location crosses the polygon's edges an odd
+number of times).
+INPUTS: (IN) double x, y  (easting and northing of the location)
+        (IN) const double *vert  (easting and northing of each vertex)
+        (IN) int n  (number of vertices)
+OUTPUTS: int 1=inside, 0=outside
+*****************************************************************/
+static int inside(double x, double y, const double *vert, int n) {
+
+  int i, j, in = 0;
+  double xi, yi, xj, yj;
+
+  for (i = 0, j = n - 1; i < n; j = i++) {
+    xi = vert[2*i]; yi = vert[2*i+1];
+    xj = vert[2*j]; yj = vert[2*j+1];
+    if ((yi > y) != (yj > y) && x < xi + (y - yi) * (xj - xi) / (yj - yi)) in = !in;
+  }
+  return in;
+}
+
+/****************************************************************
+FUNCTION: mask_prisms
+DESCRIPTION: Marks the interior prisms whose centers are outside the
+MASK_FILE polygon as CELL_MASKED (the node root writes the shared
+prisms; see create_index()). Every process must call it.
+INPUTS: (IN/OUT) PRISM *pr  (the prisms, written by the node root)
+        (IN) PARAMETER P  (the model grid)
+OUTPUTS: int, the number of prisms outside the mask, or -1 on error
+*****************************************************************/
+int mask_prisms(PRISM *pr, PARAMETER P) {
+
+  double *vert;
+  int n, x, y, out = 0;
+
+  if ( !MASK_FILE[0] ) return 0;
+  if ((vert = read_polygon(&n)) == NULL) return -1;
+  /* the border prisms are fixed at the depth to top in any case */
+  for (y = 1; y < P.row - 1; y++)
+    for (x = 1; x < P.col - 1; x++)
+      if ( !inside(P.min_easting + (x + 0.5) * P.sp, P.max_northing - (y + 0.5) * P.sp, vert, n) ) {
+        if (is_node_root()) (pr + y * P.col + x)->b = CELL_MASKED;
+        out++;
+      }
+  free(vert);
+  return out;
+}
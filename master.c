@@ -94,11 +94,39 @@ double master(void) {
 
   int num_evals; /* the number of function evaluations taken */
 
+  /* the column sums of the simplex (sum of each parameter over all vertices) */
+  double psum[NUM_OF_PARAMS];
+
+  int resume = 0; /* 1 if the simplex was restored from a checkpoint */
+  int first_eval; /* evaluations taken before the simplex is optimized */
+  unsigned long allocs; /* calls to malloc() made before the simplex is optimized */
+  double start; /* when the simplex started being optimized */
+
   /* the set of parameters we are trying to optimize */
   double param_val[NUM_OF_PARAMS]; 
 
  if (DEBUG) fprintf(stderr, "ENTER[master]\n");
-    
+
+    /* A restarted run continues from the saved simplex; if there is no usable
+       checkpoint (e.g. the first run of a job script that always restarts) 
+       a new inversion is started. */
+    if (RESTART) {
+      if (read_checkpoint(optimal_param, minimizing_func_value, psum, &num_evals))
+        fprintf(stderr, "Cannot restart from checkpoint, starting a new inversion\n");
+      else {
+        fprintf(stderr, "Restarting from checkpoint [%s] after %d evaluations\n", 
+                CHECKPOINT_FILE, num_evals);
+        if (REBALANCE_INTERVAL > 0)
+          fprintf(stderr, "REBALANCE_INTERVAL: the points are partitioned afresh, so the resumed "
+                  "run matches the interrupted one only to within rounding\n");
+        resume = 1;
+      }
+    }
+  
+  fprintf(stderr, "Time to first evaluation: %.3f seconds\n", log_elapsed());
+  log_msg(LOG_SUMMARY, "Time to first evaluation: %.3f seconds\n", log_elapsed());
+  
+  if (!resume) {
     /* initial parameter guesses : optimal_parameter[vertex][parameter]*/
  
     init_optimal_params(optimal_param); 
@@ -111,37 +139,50 @@ double master(void) {
 
   
     the number of vertices equals one more than the number of parameters being optimized */
-    for (vert=0; vert < NUM_OF_VERTICES; vert++) { 
-		//fprintf(stderr, "VERT=%d ",vert);
-      for (param=0; param < NUM_OF_PARAMS; param++) {
-        //fprintf(stderr, "%d ",param);
-		  param_val[param] = optimal_param[vert][param];
-		 // fprintf(stderr, "p_val=%f ",param_val[param]);
-	   }
-	  // fprintf(stderr, "\n");
-      minimizing_func_value[vert] = minimizing_func( param_val );
-      /*if (DEBUG) fprintf(stderr, "[%d]chi=%f\n", vert, minimizing_func_value[vert]);*/
-      //fprintf(stderr, "[%d]chi=%f ", vert, minimizing_func_value[vert]);
-    }
+    evaluate_vertices(optimal_param, minimizing_func_value, -1, minimizing_func_batch);
 	
 	 fprintf(stderr, "\n");
+  }
 
     /* the dimension of the simplex equals the number of parameters being optimized */
    // fprintf(stderr, "TOLERANCE = %e\n", (double)TOLERANCE);
+    first_eval = resume ? num_evals : 0;
+    allocs = arena_allocations();
+    /* the evaluations are timed as phases of their own (see timer.c) */
+    start = MPI_Wtime();
+    phase_begin(PHASE_SIMPLEX);
     optimize_params(optimal_param, 
 		    minimizing_func_value,  
+		    psum,
 		    TOLERANCE, 
 		    minimizing_func, 
-		    &num_evals);
+		    minimizing_func_batch,
+		    &num_evals,
+		    resume);
+    phase_end();
+    phase_rate(num_evals - first_eval, MPI_Wtime() - start);
     
     for ( vert=0; vert < NUM_OF_VERTICES; vert++ ) {
       fprintf(stderr,"[%d]chi=%f\n", vert, minimizing_func_value[vert]);
     }
     
     fprintf(stderr, "BEST FIT = %f\n", minimizing_func_value[0]); 
+    
+    /* should be none: every buffer is allocated before or at the first evaluation */
+    allocs = arena_allocations() - allocs;
+    fprintf(stderr, "Allocations while optimizing: %lu in %d evaluations (%.4f per evaluation)\n",
+            allocs, num_evals - first_eval, 
+            (num_evals > first_eval) ? (double)allocs / (num_evals - first_eval) : 0.0);
+    log_msg(LOG_SUMMARY, "Allocations while optimizing: %lu in %d evaluations\n", 
+            allocs, num_evals - first_eval);
+    
+    /* The last periodic dump must not overwrite the final output */
+    dump_finish();
+    writer_stop();
     /* for ( param=0; param < NUM_OF_PARAMS; param++) 
 	  fprintf(stderr, "\tPrism[%d]: %f\n", param, optimal_param[i][param]); */
     
+    phase_begin(PHASE_OUTPUT);
     printout_points();
 
     for (param=0; param < NUM_OF_PARAMS; param++)
@@ -149,6 +190,7 @@ double master(void) {
 
     assign_new_params( param_val );
     printout_model();
+    phase_end();
     if (DEBUG) fprintf(stderr, "EXIT[master]\n");
     return  minimizing_func_value[0];
 }
@@ -2,12 +2,23 @@
 	 File Name:   minimizing function.c
 
 	 Program Name:  grav_parallel        
-	 Subroutine Name(s): test_bounds(), init_globals(), get_points(),
+	 Subroutine Name(s): test_bounds(), open_config(), init_globals(), get_points(),
                        setup_prisms(), get_prisms(),
-                       minimizing_func(),
+                       minimizing_func(), minimizing_func_batch(),
+                       send_command(), recv_command(), gather_calculated(),
+                       balance_check(), rebalance_points(),
+                       setup_process_grid(), set_partition(),
+                       open_survey(), load_points(),
+                       wait_idle(), finish_pending(), report_idle(),
+                       calc_points(), calc_points_batch(), fixed_field(), fixed_points(),
                        assign_new_params(), init_optimal_params(), 
                        printout_points(), printout_parameters(),
-                       printout_model(), _free(), rmse()
+                       printout_model(), open_output(), close_output(),
+                       print_points(), print_model(), print_model_binary(),
+                       field_layout(), write_calculated(), write_snapshot(),
+                       dump_best(), dump_field(), dump_complete(), dump_finish(),
+                       note_best(), keep_best(), _free(), rmse(),
+                       get_rng_state(), set_rng_state()
                        
 	 Release Date:         April 1, 2020
 	 Release Version:      1.0
@@ -71,9 +82,15 @@
 #include <string.h>
 #include <errno.h>
 #include <math.h>
+#include <limits.h>
 #include <mpi.h>
 #include <time.h>
-#include <gc.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "prototypes.h"
 
 /* The maximum line length */
@@ -81,22 +98,79 @@
 #define README "parameters.README"
 
 static unsigned int SEED = 0;
+static unsigned long RAND_DRAWS = 0; /* random numbers drawn since srand(SEED) */
 static POINT *p_all=NULL;
-static int total_pts = 0;
+static long total_pts = 0;
+static long *place=NULL; /* position in p_all of each point of the file (HILBERT_ORDER) */
+static double dumped_fit = HUGE_VAL; /* RMSE of the model last handed to the output writer */
+
+/* the best model evaluated so far, whose field each node keeps in POINT.best (see keep_best()) */
+static double best_fit = HUGE_VAL; /* master: its RMSE */
+static double *best_model=NULL; /* the model, as prism depths (num_depths of them) */
+static int best_set = -1; /* master: the parameter set of the last evaluation that is the best model, not yet announced */
+static int last_sets = 1; /* number of parameter sets of this node's last evaluation */
+static MPI_Request dump_req = MPI_REQUEST_NULL; /* the gather of a dumped text field, still in flight */
+static SNAPSHOT *dump_snap = NULL; /* master: the snapshot that gather fills */
+static int *dump_counts=NULL; /* master: the int counts and displacements of that gather */
+static int *dump_displs=NULL;
+static long *write_order=NULL; /* this node's points in the order of the points file (HILBERT_ORDER) */
+static MPI_Aint *write_disp=NULL; /* offset of each of those points in the binary field file */
+static SURVEY_HEADER *survey=NULL; /* a binary survey file, mapped into memory */
+static size_t survey_bytes = 0; /* size of the mapping */
+static int streaming = 0; /* 1 = this node's points are read from the survey, STREAM_POINTS at a time */
+static long stream_first = 0; /* this node's first point in the survey file */
 
 /* local node varialbles */
 static int procs=-1;
 static int my_rank=-1;
-static int my_count=-1; /* byte count of node's POINT array */
-static int *displ=NULL;
-static int *recv_ct=NULL; /* pointers to arrays of integers based on total number of nodes */
+static size_t my_count=0; /* byte count of node's POINT array */
+static long *displ=NULL; /* first point of each node in the global POINT array */
+static long *recv_ct=NULL; /* number of points each node sends to the master */
+static MPI_Datatype MPI_POINT; /* a POINT structure */
+static MPI_Datatype MPI_CALC; /* the calculated value within a POINT structure */
+
+static long num_pts = 0;
+static int num_threads = 1; /* OpenMP threads per node */
+
+/* process grid: each point group shares one block of points, and each node
+   of a point group calculates the field of one block of prisms there */
+static int ngroups = 1; /* number of point groups */
+static int group = 0; /* this node's point group */
+static int block = 0; /* this node's prism block, 0 = the point group's leader */
+static int first_prism = 0; /* first prism of this node's block */
+static int num_prisms = 0; /* number of prisms in this node's block */
+static MPI_Comm row_comm = MPI_COMM_NULL; /* the nodes of this point group */
+
+/* load balancing: this node's work since the points were last repartitioned */
+static double work_time = 0.0; /* seconds spent calculating */
+static double work_points = 0.0; /* number of point evaluations calculated */
+static int evals_since_balance = 0; /* master: evaluations since the last repartition */
 
-static int num_pts = 0;
+/* communication: this node's time spent waiting, and its last reduction still in flight */
+static double idle_time = 0.0; /* seconds spent waiting for the master or the other nodes */
+static double start_time = 0.0; /* when the points had been read */
+static MPI_Request pending = MPI_REQUEST_NULL; /* a slave's last sum of squares reduction */
+static double ss_send = 0.0; /* this node's sum of squares, sent by the pending reduction */
 static POINT *pt=NULL;
-static PRISM *pr=NULL;
+static PRISM *pr=NULL; /* prism outlines, shared by the processes of a node */
+static int *depth_index=NULL; /* the parameter that is each prism's depth to bottom (see create_index()) */
+static int *fixed_index=NULL; /* DEPTH_TO_BOT for each prism outside the mask, DEPTH_TO_TOP for the others */
+static double fixed_model[LAST_PARAM]; /* depth to top, unit density, and MASK_DEPTH (see fixed_field()) */
+static int num_fixed = 0; /* number of prisms outside the mask that have a thickness */
+static double *stream_fixed=NULL; /* when streaming, the fixed field at each of this node's points */
+static long stream_fixed_end = 0; /* the fixed field is in stream_fixed for the points before this one */
+static const double *model=NULL; /* the parameters being evaluated (see assign_new_params()) */
+static int num_depths = 0; /* length of a model: depth to top, density, depth to bottom of each free prism */
+static double *depths=NULL; /* the model expanded from the control values (PARAM_BSPLINE) */
+static double *batch_depths=NULL; /* the same for each parameter set of a batch */
+static double *bottom=NULL; /* depth to the bottom of each prism, of the model last printed out */
 static PARAMETER P;
 static FILE *log_file=NULL;
-static double **GRID=NULL;
+
+/* storage for batched evaluations of up to BATCH_SIZE parameter sets */
+static double *batch_calc=NULL; /* this node's calculated values, [point][candidate] */
+static double *batch_ss=NULL; /* this node's sum of squared errors for each candidate */
+static double *batch_sum=NULL; /* master: sum of squared errors over all nodes */
 
 /****************************************************************
 FUNCTION: test_bounds
@@ -123,6 +197,69 @@ void test_bounds(int param, double *try, double bound) {
   
 }
 
+/****************************************************************
+FUNCTION: open_config
+DESCRIPTION: Only the master reads the configuration file; its text
+is broadcast to the other nodes, which read it from memory. The text
+must be released with free() after the stream has been closed.
+INPUTS:  (IN) char *config_file  (complete path to the configuration file)
+         (OUT) char **text  (the text of the configuration file)
+OUTPUTS: FILE *, a stream over the text, or NULL on error
+ ****************************************************************/
+static FILE *open_config(char *config_file, char **text) {
+
+  FILE *conf_file;
+  long len = -1;
+
+  *text = NULL;
+  if ( !my_rank ) {
+    conf_file = fopen(config_file, "r");
+    if (conf_file == NULL) 
+      fprintf(stderr, 
+	      "[%d-of-%d]\tCannot open configuration file=[%s]:[%s]. Exiting.\n", 
+	      my_rank, procs, config_file, strerror(errno)); 
+    else {
+      if (!fseek(conf_file, 0L, SEEK_END)) len = ftell(conf_file);
+      if (len >= 0 && (*text = (char *)malloc((size_t)len + 1)) != NULL) {
+        rewind(conf_file);
+        if (fread(*text, 1, (size_t)len, conf_file) != (size_t)len) len = -1;
+      }
+      else len = -1;
+      if (len < 0) 
+        fprintf(stderr, "[%d-of-%d]\tCannot read configuration file=[%s]:[%s]. Exiting.\n", 
+                my_rank, procs, config_file, strerror(errno));
+      (void) fclose(conf_file);
+    }
+  }
+  MPI_Bcast(&len, 1, MPI_LONG, 0, MPI_COMM_WORLD);
+  if (len < 0) {
+    free(*text);
+    *text = NULL;
+    return NULL;
+  }
+  if (my_rank) *text = (char *)malloc((size_t)len + 1);
+  if (*text == NULL) {
+    fprintf(stderr, "[%d-of-%d]\tCannot malloc memory for the configuration:[%s]\n",
+            my_rank, procs, strerror(errno));
+    return NULL;
+  }
+  if (bcast_long(*text, len, MPI_BYTE, 0, MPI_COMM_WORLD)) {
+    fprintf(stderr, "[%d-of-%d]\tCannot receive the configuration\n", my_rank, procs);
+    free(*text);
+    *text = NULL;
+    return NULL;
+  }
+  (*text)[len] = '\0';
+  conf_file = fmemopen(*text, (size_t)len, "r");
+  if (conf_file == NULL) {
+    fprintf(stderr, "[%d-of-%d]\tCannot read the configuration from memory:[%s]\n",
+            my_rank, procs, strerror(errno));
+    free(*text);
+    *text = NULL;
+  }
+  return conf_file;
+}
+
 /****************************************************************
 FUNCTION: init_globals
 DESCRIPTION: This function reads a configuration file
@@ -133,11 +270,12 @@ OUTPUTS: int 1=error, 0=no error
 int init_globals(char *config_file, INPUTS *in) {
 	
   FILE *conf_file;
+  char *conf_text;
   char buf[1][30], **ptr1;
   char line[MAX_LINE];
   char space[4] = "\n\t ";
   char *token;
-  int i;
+  int active; /* number of prisms whose depth is a parameter */
   
   /* Find out how many processes are being used */
   MPI_Comm_size(MPI_COMM_WORLD, &procs);
@@ -145,14 +283,23 @@ int init_globals(char *config_file, INPUTS *in) {
   /* Get my process rank, an integer */
   MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
   
-  conf_file = fopen(config_file, "r");
-  if (conf_file == NULL) {
-    fprintf(stderr, 
-	    "[%d-of-%d]\tCannot open configuration file=[%s]:[%s]. Exiting.\n", 
-	    my_rank, procs, config_file, strerror(errno)); 
-    return 1;
-  }
-  fprintf(stderr, "[Node %d]Reading config file: %s\n",my_rank, config_file );
+  /* Find the other processes on this compute node, for shared storage */
+  if (init_node_comm()) return 1;
+  
+#ifdef _OPENMP
+  num_threads = omp_get_max_threads();
+#endif
+#ifdef NO_MPI
+  /* The threads-only build shares the points among its own pool of threads */
+  token = getenv("OMP_NUM_THREADS");
+  if (pool_init((token != NULL) ? atoi(token) : (int)sysconf(_SC_NPROCESSORS_ONLN))) return 1;
+  num_threads = pool_size();
+#endif
+  log_msg(LOG_INFO, "Threads per node = %d\n", num_threads);
+  
+  conf_file = open_config(config_file, &conf_text);
+  if (conf_file == NULL) return 1;
+  if ( !my_rank ) fprintf(stderr, "[Node %d]Reading config file: %s\n",my_rank, config_file );
   
   ptr1 = (char **)&buf[0];
   while (fgets(line, MAX_LINE, conf_file) != NULL) { 
@@ -165,75 +312,189 @@ int init_globals(char *config_file, INPUTS *in) {
     if (!strncmp(token, "TOLERANCE", strlen("TOLERANCE"))) {
       token = strtok_r(NULL, space, ptr1);
       TOLERANCE = strtod(token, NULL);
-      fprintf(log_file, "TOLERANCE = %f\n", TOLERANCE);
+      log_msg(LOG_INFO, "TOLERANCE = %f\n", TOLERANCE);
       if (!TOLERANCE) TOLERANCE = 0.00001;
     }
     else if (!strncmp(token, "MIN_ROC_DENSITY", strlen("MIN_ROC_DENSITY"))) {
       token = strtok_r(NULL,space,ptr1);
       _LO[DENSITY] = strtod(token, NULL);
       P.density = _LO[DENSITY];
-      fprintf(log_file, "MIN ROC DENSITY=%.2f\n", _LO[DENSITY]); 
+      log_msg(LOG_INFO, "MIN ROC DENSITY=%.2f\n", _LO[DENSITY]); 
     }
     else if (!strncmp(token, "MAX_ROC_DENSITY", strlen("MAX_ROC_DENSITY"))) {
       token = strtok_r(NULL,space,ptr1);
       _HI[DENSITY] = strtod(token, NULL);
-      fprintf(log_file, "MAX ROC DENSITY=%.2f\n", _HI[DENSITY]);
+      log_msg(LOG_INFO, "MAX ROC DENSITY=%.2f\n", _HI[DENSITY]);
     }
     else if (!strncmp(token, "MIN_NORTHING", strlen("MIN_NORTHING"))) {
       token = strtok_r(NULL,space,ptr1);
       P.min_northing = strtod(token, NULL);
-      fprintf(log_file, "MIN Northing = %f\n",  P.min_northing);
+      log_msg(LOG_INFO, "MIN Northing = %f\n",  P.min_northing);
     }
     else if (!strncmp(token, "MAX_NORTHING", strlen("MAX_NORTHING"))) {
       token = strtok_r(NULL,space,ptr1);
       P.max_northing = strtod(token, NULL);
-      fprintf(log_file, "MAX Northing = %f\n", P.max_northing);
+      log_msg(LOG_INFO, "MAX Northing = %f\n", P.max_northing);
     }
     else if (!strncmp(token, "MIN_EASTING", strlen("MIN_EASTING"))) {
       token = strtok_r(NULL,space,ptr1);
       P.min_easting = strtod(token, NULL);
-      fprintf(log_file, "MIN Easting = %f\n",  P.min_easting);
+      log_msg(LOG_INFO, "MIN Easting = %f\n",  P.min_easting);
    }
    else if (!strncmp(token, "MAX_EASTING", strlen("MAX_EASTING"))) {
       token = strtok_r(NULL,space,ptr1);
       P.max_easting = strtod(token, NULL);
-      fprintf(log_file, "MAX Easting = %f\n", P.max_easting);
+      log_msg(LOG_INFO, "MAX Easting = %f\n", P.max_easting);
     }
     else if (!strncmp(token, "MIN_DEPTH_TO_TOP", strlen("MIN_DEPTH_TO_TOP"))) {
       token = strtok_r(NULL,space,ptr1);
       _LO[DEPTH_TO_TOP] = strtod(token, NULL);
       P.depth_to_top = _LO[DEPTH_TO_TOP]; 
-      fprintf(log_file, "MIN DEPTH TO TOP = %f\n", _LO[DEPTH_TO_TOP]);
+      log_msg(LOG_INFO, "MIN DEPTH TO TOP = %f\n", _LO[DEPTH_TO_TOP]);
     }  
     else if (!strncmp(token, "MAX_DEPTH_TO_TOP", strlen("MAX_DEPTH_TO_TOP"))) {
       token = strtok_r(NULL,space,ptr1);
       _HI[DEPTH_TO_TOP] = strtod(token, NULL);
       //P.depth_to_top = _HI[DEPTH_TO_TOP]; 
-      fprintf(log_file, "MAX DEPTH TO TOP = %f\n", _HI[DEPTH_TO_TOP]);
+      log_msg(LOG_INFO, "MAX DEPTH TO TOP = %f\n", _HI[DEPTH_TO_TOP]);
     }
     else if (!strncmp(token, "MIN_DEPTH_TO_BOTTOM", strlen("MIN_DEPTH_TO_BOTTOM"))) {
       token = strtok_r(NULL,space,ptr1);
       _LO[DEPTH_TO_BOT] = strtod(token, NULL);
-      fprintf(log_file, "MIN DEPTH TO BOTTOM = %f\n", _LO[DEPTH_TO_BOT]);
+      log_msg(LOG_INFO, "MIN DEPTH TO BOTTOM = %f\n", _LO[DEPTH_TO_BOT]);
    }
    else if (!strncmp(token, "MAX_DEPTH_TO_BOTTOM", strlen("MAX_DEPTH_TO_BOTTOM"))) {
       token = strtok_r(NULL,space,ptr1);
       _HI[DEPTH_TO_BOT] = strtod(token, NULL); 
-      fprintf(log_file, "MAX DEPTH TO BOTTOM = %f\n", _HI[DEPTH_TO_BOT]);   
+      log_msg(LOG_INFO, "MAX DEPTH TO BOTTOM = %f\n", _HI[DEPTH_TO_BOT]);   
     }    
     else if (!strncmp(token, "SPACING", strlen("SPACING"))) {
       token = strtok_r(NULL,space,ptr1);
       P.sp = strtod(token, NULL);
-      fprintf(log_file, "Spacing = %f\n", P.sp);
+      log_msg(LOG_INFO, "Spacing = %f\n", P.sp);
     }
     else if (!strncmp(token, "SEED", strlen("SEED"))) {
       token = strtok_r(NULL, space, ptr1);
       SEED = (unsigned int)atoi(token);
-      fprintf(log_file, "SEED = %u\n", SEED);
+      log_msg(LOG_INFO, "SEED = %u\n", SEED);
+    }
+    else if (!strncmp(token, "CHECKPOINT_INTERVAL", strlen("CHECKPOINT_INTERVAL"))) {
+      token = strtok_r(NULL, space, ptr1);
+      CHECKPOINT_INTERVAL = atoi(token);
+      log_msg(LOG_INFO, "CHECKPOINT_INTERVAL = %d\n", CHECKPOINT_INTERVAL);
+    }
+    else if (!strncmp(token, "CHECKPOINT_FILE", strlen("CHECKPOINT_FILE"))) {
+      token = strtok_r(NULL, space, ptr1);
+      if (strlen(token) >= MAX_FILENAME) {
+        fprintf(stderr, "\n[INITIALIZE] CHECKPOINT_FILE name is too long!\n");
+        return 1;
+      }
+      strcpy(CHECKPOINT_FILE, token);
+      log_msg(LOG_INFO, "CHECKPOINT_FILE = %s\n", CHECKPOINT_FILE);
+    }
+    else if (!strncmp(token, "ADAPTIVE_SIMPLEX", strlen("ADAPTIVE_SIMPLEX"))) {
+      token = strtok_r(NULL, space, ptr1);
+      ADAPTIVE_SIMPLEX = atoi(token);
+      log_msg(LOG_INFO, "ADAPTIVE_SIMPLEX = %d\n", ADAPTIVE_SIMPLEX);
+    }
+    else if (!strncmp(token, "STALL_EVALS", strlen("STALL_EVALS"))) {
+      token = strtok_r(NULL, space, ptr1);
+      STALL_EVALS = atoi(token);
+      log_msg(LOG_INFO, "STALL_EVALS = %d\n", STALL_EVALS);
+    }
+    else if (!strncmp(token, "STALL_TOLERANCE", strlen("STALL_TOLERANCE"))) {
+      token = strtok_r(NULL, space, ptr1);
+      STALL_TOLERANCE = strtod(token, NULL);
+      log_msg(LOG_INFO, "STALL_TOLERANCE = %f\n", STALL_TOLERANCE);
+    }
+    else if (!strncmp(token, "REBUILD_STEP", strlen("REBUILD_STEP"))) {
+      token = strtok_r(NULL, space, ptr1);
+      REBUILD_STEP = strtod(token, NULL);
+      log_msg(LOG_INFO, "REBUILD_STEP = %f\n", REBUILD_STEP);
+    }
+    else if (!strncmp(token, "BATCH_SIZE", strlen("BATCH_SIZE"))) {
+      token = strtok_r(NULL, space, ptr1);
+      BATCH_SIZE = atoi(token);
+      if (BATCH_SIZE < 1) BATCH_SIZE = 1;
+      log_msg(LOG_INFO, "BATCH_SIZE = %d\n", BATCH_SIZE);
+    }
+    else if (!strncmp(token, "REBALANCE_INTERVAL", strlen("REBALANCE_INTERVAL"))) {
+      token = strtok_r(NULL, space, ptr1);
+      REBALANCE_INTERVAL = atoi(token);
+      log_msg(LOG_INFO, "REBALANCE_INTERVAL = %d\n", REBALANCE_INTERVAL);
+    }
+    else if (!strncmp(token, "HILBERT_ORDER", strlen("HILBERT_ORDER"))) {
+      token = strtok_r(NULL, space, ptr1);
+      HILBERT_ORDER = atoi(token);
+      log_msg(LOG_INFO, "HILBERT_ORDER = %d\n", HILBERT_ORDER);
+    }
+    else if (!strncmp(token, "NONBLOCKING", strlen("NONBLOCKING"))) {
+      token = strtok_r(NULL, space, ptr1);
+      NONBLOCKING = atoi(token);
+      log_msg(LOG_INFO, "NONBLOCKING = %d\n", NONBLOCKING);
+    }
+    else if (!strncmp(token, "OUTPUT_FORMAT", strlen("OUTPUT_FORMAT"))) {
+      token = strtok_r(NULL, space, ptr1);
+      if (!strcmp(token, "binary")) OUTPUT_FORMAT = OUTPUT_BINARY;
+      else if (!strcmp(token, "text")) OUTPUT_FORMAT = OUTPUT_TEXT;
+      else fprintf(stderr, "[%d-of-%d]\tUnknown OUTPUT_FORMAT [%s], using text\n", my_rank, procs, token);
+      log_msg(LOG_INFO, "OUTPUT_FORMAT = %s\n", (OUTPUT_FORMAT == OUTPUT_BINARY) ? "binary" : "text");
+    }
+    else if (!strncmp(token, "LOG_LEVEL", strlen("LOG_LEVEL"))) {
+      token = strtok_r(NULL, space, ptr1);
+      LOG_LEVEL = atoi(token);
+      log_msg(LOG_INFO, "LOG_LEVEL = %d\n", LOG_LEVEL);
+    }
+    else if (!strncmp(token, "STREAM_POINTS", strlen("STREAM_POINTS"))) {
+      token = strtok_r(NULL, space, ptr1);
+      /* a chunk's rows (three doubles per point) are written with one int count */
+      if (strtol(token, NULL, 10) > INT_MAX / 3) {
+        fprintf(stderr, "\n[INITIALIZE] STREAM_POINTS must be at most %d!\n", INT_MAX / 3);
+        return 1;
+      }
+      STREAM_POINTS = atoi(token);
+      if (STREAM_POINTS < 0) STREAM_POINTS = 0;
+      log_msg(LOG_INFO, "STREAM_POINTS = %d\n", STREAM_POINTS);
+    }
+    else if (!strncmp(token, "MASK_FILE", strlen("MASK_FILE"))) {
+      token = strtok_r(NULL, space, ptr1);
+      if (strlen(token) >= MAX_FILENAME) {
+        fprintf(stderr, "\n[INITIALIZE] MASK_FILE name is too long!\n");
+        return 1;
+      }
+      strcpy(MASK_FILE, token);
+      log_msg(LOG_INFO, "MASK_FILE = %s\n", MASK_FILE);
+    }
+    else if (!strncmp(token, "MASK_DEPTH", strlen("MASK_DEPTH"))) {
+      token = strtok_r(NULL, space, ptr1);
+      MASK_DEPTH = strtod(token, NULL);
+      log_msg(LOG_INFO, "MASK_DEPTH = %f\n", MASK_DEPTH);
+    }
+    else if (!strncmp(token, "PARAMETERIZATION", strlen("PARAMETERIZATION"))) {
+      token = strtok_r(NULL, space, ptr1);
+      if (!strcmp(token, "bspline")) PARAMETERIZATION = PARAM_BSPLINE;
+      else if (!strcmp(token, "prisms")) PARAMETERIZATION = PARAM_PRISMS;
+      else fprintf(stderr, "[%d-of-%d]\tUnknown PARAMETERIZATION [%s], using prisms\n", my_rank, procs, token);
+      log_msg(LOG_INFO, "PARAMETERIZATION = %s\n", (PARAMETERIZATION == PARAM_BSPLINE) ? "bspline" : "prisms");
+    }
+    else if (!strncmp(token, "BASIS_ROWS", strlen("BASIS_ROWS"))) {
+      token = strtok_r(NULL, space, ptr1);
+      BASIS_ROWS = atoi(token);
+      log_msg(LOG_INFO, "BASIS_ROWS = %d\n", BASIS_ROWS);
+    }
+    else if (!strncmp(token, "BASIS_COLS", strlen("BASIS_COLS"))) {
+      token = strtok_r(NULL, space, ptr1);
+      BASIS_COLS = atoi(token);
+      log_msg(LOG_INFO, "BASIS_COLS = %d\n", BASIS_COLS);
+    }
+    else if (!strncmp(token, "PRISM_BLOCKS", strlen("PRISM_BLOCKS"))) {
+      token = strtok_r(NULL, space, ptr1);
+      PRISM_BLOCKS = atoi(token);
+      log_msg(LOG_INFO, "PRISM_BLOCKS = %d\n", PRISM_BLOCKS);
     }
     else if (!strncmp(token, "OBS_GRAV_FILE", strlen("OBS_GRAV_FILE"))) {
     	token = strtok_r(NULL, space, ptr1);
-    	in->points_file = (char*) GC_MALLOC(sizeof(char) * (strlen(token)+1));
+    	in->points_file = (char*) arena_alloc(sizeof(char) * (strlen(token)+1));
 			if (in->points_file == NULL) 
 			{
 				fprintf(stderr, 
@@ -242,51 +503,320 @@ int init_globals(char *config_file, INPUTS *in) {
 			}
 			memset(in->points_file, '\0', strlen(in->points_file));
 			strcpy(in->points_file, token);
-			fprintf(log_file, "OBS_GRAV_FILE = %s\n", in->points_file);
+			log_msg(LOG_INFO, "OBS_GRAV_FILE = %s\n", in->points_file);
     }
     else continue;
   }
+  (void) fclose(conf_file);
+  free(conf_text);
+  
+  /* Streamed points are never all in memory: they stay in file order and on
+     their nodes, and the calculated field can only be written in binary */
+  if (STREAM_POINTS > 0 && (HILBERT_ORDER || REBALANCE_INTERVAL > 0 || OUTPUT_FORMAT != OUTPUT_BINARY)) {
+    if ( !my_rank ) 
+      fprintf(stderr, "STREAM_POINTS: HILBERT_ORDER and REBALANCE_INTERVAL are ignored, OUTPUT_FORMAT is binary\n");
+    HILBERT_ORDER = 0;
+    REBALANCE_INTERVAL = 0;
+    OUTPUT_FORMAT = OUTPUT_BINARY;
+  }
   if (in->points_file == NULL) {
   	fprintf(stderr, 
 				        "\n[INITIALIZE] No gravity observation file specified!\n");
 				return 1;
 	}
-  fprintf(log_file, "Top Surface from %.2f to %.2f\n", _LO[DEPTH_TO_TOP], _HI[DEPTH_TO_TOP]);
-  fprintf(log_file, "Bottom Surface from %.2f to %.2f\n", _LO[DEPTH_TO_BOT], _HI[DEPTH_TO_BOT]);
+  log_msg(LOG_INFO, "Top Surface from %.2f to %.2f\n", _LO[DEPTH_TO_TOP], _HI[DEPTH_TO_TOP]);
+  log_msg(LOG_INFO, "Bottom Surface from %.2f to %.2f\n", _LO[DEPTH_TO_BOT], _HI[DEPTH_TO_BOT]);
   
- fprintf(stderr, "[%d]Read complete\n", my_rank); 
+ if ( !my_rank ) fprintf(stderr, "[%d]Read complete\n", my_rank); 
  
-  NUM_OF_PARAMS = setup_prisms() + 2;
+  /* the depth to top, the density, and the depth to bottom of each interior prism inside the mask */
+  if ((active = setup_prisms()) < 0) return -1;
+  num_depths = active + 2;
+  NUM_OF_PARAMS = num_depths;
+  
+  log_msg(LOG_INFO, "%d of %d prisms are free (the border prisms%s are fixed)\n", 
+          active, P.N_units, MASK_FILE[0] ? " and those outside the mask" : "");
   
-  fprintf(log_file, "NUM_OF_PARAMS=%d\n", NUM_OF_PARAMS);
+  /* or the depth to top, the density, and the control values of the bottom surface */
+  if (PARAMETERIZATION == PARAM_BSPLINE) {
+    if ((active = basis_setup(depth_index, P)) < 0) return -1;
+    NUM_OF_PARAMS = active + 2;
+    depths = (double *)arena_alloc((size_t)num_depths * sizeof(double));
+    if (depths == NULL) {
+      fprintf(stderr, "[%d-of-%d]\tCannot malloc memory for the model:[%s]\n",
+              my_rank, procs, strerror(errno));
+      return -1;
+    }
+  }
+  log_msg(LOG_INFO, "NUM_OF_PARAMS=%d\n", NUM_OF_PARAMS);
   NUM_OF_VERTICES = NUM_OF_PARAMS + 1;
 
-  GRID = (double **)GC_MALLOC((size_t)P.row * sizeof(double));
-  if (GRID == NULL) {
-    fprintf(stderr, "[%d-of-%d]\tCannot malloc memory for GRID rows:[%s]\n",
-	    my_rank, procs, strerror(errno));
-	 (void) fclose(conf_file);
+  if (setup_process_grid()) return -1;
+
+  /* the master keeps the best model evaluated so far, for the periodic dumps
+     (streamed points get it from the master for each dump) */
+  best_model = (double *)arena_alloc((size_t)num_depths * sizeof(double));
+  if ( !my_rank ) {
+    dump_counts = (int *)arena_alloc((size_t)procs * sizeof(int));
+    dump_displs = (int *)arena_alloc((size_t)procs * sizeof(int));
+  }
+  if (best_model == NULL || (!my_rank && (dump_counts == NULL || dump_displs == NULL))) {
+    fprintf(stderr, "[%d-of-%d]\tCannot malloc memory for the best model:[%s]\n",
+            my_rank, procs, strerror(errno));
     return -1;
-  } 
-  
-  else {
-    for (i=0; i < P.row; i++) {
-      GRID[i] = (double *)GC_MALLOC((size_t)P.col * sizeof(double));
-      if (GRID[i] == NULL) {
-	     fprintf(stderr, "[%d-of-%d]\tCannot malloc memory for grid row %d:[%s]\n",
-		    my_rank, procs, i, strerror(errno));
-		  (void) fclose(conf_file);
-	     return -1;
-      }
-    }
   }
  
-  (void) fclose(conf_file);
   return 0;
 } 
 
 
 
+/*****************************************************************
+FUNCTION:  setup_process_grid
+DESCRIPTION:  Arranges the nodes in a grid of point groups (rows) by
+PRISM_BLOCKS prism blocks (columns). The nodes of a point group hold
+the same points; each calculates the field of its own block of prisms
+there, and the partial fields are added up at the group's first node
+(its leader) before the misfit is calculated. With PRISM_BLOCKS = 1
+every node is a point group of its own, i.e. only the points are
+divided among the nodes.
+INPUTS: none
+OUTPUTS: int 1=error, 0=no error
+ ****************************************************************/
+int setup_process_grid(void) {
+
+  if (PRISM_BLOCKS < 1 || procs % PRISM_BLOCKS || PRISM_BLOCKS > P.N_units) {
+    if ( !my_rank ) 
+      fprintf(stderr, "PRISM_BLOCKS=%d must divide the %d nodes and be at most %d, using 1\n",
+              PRISM_BLOCKS, procs, P.N_units);
+    PRISM_BLOCKS = 1;
+  }
+  ngroups = procs / PRISM_BLOCKS;
+  group = my_rank / PRISM_BLOCKS;
+  block = my_rank % PRISM_BLOCKS;
+  first_prism = (int)((long)block * P.N_units / PRISM_BLOCKS);
+  num_prisms = (int)((long)(block + 1) * P.N_units / PRISM_BLOCKS) - first_prism;
+
+  if (MPI_Comm_split(MPI_COMM_WORLD, group, block, &row_comm) != MPI_SUCCESS) {
+    fprintf(stderr, "[%d-of-%d]\tCannot group the nodes of point group %d\n", my_rank, procs, group);
+    return 1;
+  }
+  log_msg(LOG_INFO, "Process grid: %d point groups x %d prism blocks\n"
+          "\tpoint group %d, prisms %d to %d\n",
+          ngroups, PRISM_BLOCKS, group, first_prism, first_prism + num_prisms - 1);
+  return 0;
+}
+
+/*****************************************************************
+FUNCTION:  set_partition
+DESCRIPTION:  Given the number of points of each point group, sets
+this node's number of points and, for every node, the number of
+points it sends to the master and where they go in the master's
+POINT array. Only a point group's leader sends its points.
+INPUTS: (IN) long count[]  (number of points of each point group)
+OUTPUTS: long, the first point of this node's point group
+ ****************************************************************/
+static long set_partition(long count[]) {
+  int i;
+  long start = 0, my_start = 0;
+
+  for (i = 0; i < procs; i++) {
+    if (i % PRISM_BLOCKS == 0 && i > 0) start += count[i / PRISM_BLOCKS - 1];
+    recv_ct[i] = (i % PRISM_BLOCKS) ? 0 : count[i / PRISM_BLOCKS];
+    displ[i] = start;
+    if (i == my_rank) my_start = start;
+  }
+  num_pts = count[group];
+  return my_start;
+}
+
+/*****************************************************************
+FUNCTION:  open_survey
+DESCRIPTION:  Checks whether the points file is a binary survey file
+(see xyz2bin.c). If it is, the file is mapped into memory; only the
+pages holding the points that are loaded are ever read from disk.
+INPUTS: (IN) FILE *in  (the points file, at its start)
+OUTPUTS: int 1=error, 0=no error (survey is NULL for a text file)
+ ****************************************************************/
+static int open_survey(FILE *in) {
+  
+  SURVEY_HEADER head;
+  struct stat st;
+  void *map;
+  int c;
+
+  if (fread(&head, sizeof head, 1, in) != 1 || 
+      memcmp(head.magic, SURVEY_MAGIC, sizeof head.magic)) {
+    rewind(in);
+    return 0;
+  }
+  if (head.version != SURVEY_VERSION || head.byte_order != SURVEY_BYTE_ORDER ||
+      head.size_of_double != (int)sizeof(double) || head.num_columns != SURVEY_COLUMNS) {
+    fprintf(stderr, "[%d-of-%d]\tThe points file is not a version %d survey file for this machine\n",
+            my_rank, procs, SURVEY_VERSION);
+    return 1;
+  }
+  if (fstat(fileno(in), &st)) {
+    fprintf(stderr, "[%d-of-%d]\tCannot stat the points file:[%s]\n", my_rank, procs, strerror(errno));
+    return 1;
+  }
+  for (c = 0; c < SURVEY_COLUMNS; c++)
+    if (head.column_offset[c] % sizeof(double) ||
+        head.column_offset[c] + head.count * (long)sizeof(double) > (long)st.st_size) {
+      fprintf(stderr, "[%d-of-%d]\tThe points file is truncated (column %s)\n", 
+              my_rank, procs, head.column_name[c]);
+      return 1;
+    }
+  map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fileno(in), 0);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "[%d-of-%d]\tCannot map the points file:[%s]\n", my_rank, procs, strerror(errno));
+    return 1;
+  }
+  survey = (SURVEY_HEADER *)map;
+  survey_bytes = (size_t)st.st_size;
+  log_msg(LOG_INFO, "  Binary survey file: %ld points, easting %f to %f, northing %f to %f\n",
+          survey->count, survey->min_easting, survey->max_easting,
+          survey->min_northing, survey->max_northing);
+  return 0;
+}
+
+/*****************************************************************
+FUNCTION:  load_points
+DESCRIPTION:  Copies <count> points, starting at point <first>, from 
+the mapped binary survey file.
+INPUTS: (IN) long first, count  (the points to load)
+        (OUT) POINT *to
+OUTPUTS: long, the number of points loaded
+ ****************************************************************/
+static long load_points(long first, long count, POINT *to) {
+  
+  const double *column[SURVEY_COLUMNS];
+  long i;
+  int c;
+
+  for (c = 0; c < SURVEY_COLUMNS; c++)
+    column[c] = (const double *)((const char *)survey + survey->column_offset[c]) + first;
+  for (i = 0; i < count; i++) {
+    (to+i)->easting = column[SURVEY_EASTING][i];
+    (to+i)->northing = column[SURVEY_NORTHING][i];
+    (to+i)->elev = column[SURVEY_ELEV][i];
+    (to+i)->observed = column[SURVEY_OBSERVED][i];
+  }
+  return count;
+}
+
+/*****************************************************************
+FUNCTION:  stream_advise
+DESCRIPTION:  Tells the kernel how this node's points <first> to 
+<first> + <count> - 1 of the mapped survey file will be used:
+MADV_WILLNEED starts reading them ahead, MADV_DONTNEED releases the
+pages of points already copied.
+INPUTS: (IN) long first, count  (the points, from this node's first)
+        (IN) int advice  (MADV_WILLNEED or MADV_DONTNEED)
+OUTPUTS: none
+ ****************************************************************/
+static void stream_advise(long first, long count, int advice) {
+
+  long page = sysconf(_SC_PAGESIZE);
+  char *from, *to;
+  int c;
+
+  if (count > num_pts - first) count = num_pts - first;
+  if (count <= 0) return;
+  for (c = 0; c < SURVEY_COLUMNS; c++) {
+    from = (char *)survey + survey->column_offset[c] + (stream_first + first) * (long)sizeof(double);
+    to = from + count * (long)sizeof(double);
+    /* madvise() needs a page boundary, the mapping starts on one */
+    from -= (from - (char *)survey) % page;
+    (void) madvise(from, (size_t)(to - from), advice);
+  }
+}
+
+#ifdef NO_MPI
+/*****************************************************************
+FUNCTION: fixed_points
+DESCRIPTION: The point loop of fixed_field() in the threads-only 
+build, run by pool_for() for a chunk of the points.
+INPUTS: (IN) long begin, end  (the chunk of points)
+        (IN) void *arg  (PARAMETER *, for this node's block of prisms)
+RETURN:  none
+ *****************************************************************/
+static void fixed_points(long begin, long end, void *arg) {
+  long i;
+
+  for (i = begin; i < end; i++) {
+    (pt+i)->fixed = 0.0;
+    (pt+i)->fixed = gbox(pt+i, pr + first_prism, fixed_model, fixed_index + first_prism, (PARAMETER *)arg);
+  }
+}
+#endif
+
+/**************************************************************
+FUNCTION:  fixed_field
+DESCRIPTION:  Calculates the field, per unit density, of the prisms
+of this node's block that are outside the mask at the first <n> 
+points in pt. Those prisms never change, so this is done once, when 
+the points arrive (for streamed points, when a chunk is first loaded, 
+see stream_load()); gbox() adds it to the field of the other prisms.
+INPUTS: (IN) long n  (number of points)
+OUTPUTS: none 
+***************************************************************/
+static void fixed_field(long n) {
+  long i;
+  PARAMETER blk; /* the fixed prisms, for this node's block of prisms */
+
+  if ( !num_fixed ) {
+    for (i = 0; i < n; i++) (pt+i)->fixed = 0.0;
+    return;
+  }
+  blk = P;
+  blk.N_units = num_prisms;
+  blk.depth_to_top = fixed_model[DEPTH_TO_TOP];
+  blk.density = fixed_model[DENSITY];
+#ifdef NO_MPI
+  pool_for(n, fixed_points, &blk);
+#else
+#pragma omp parallel for schedule(static) if (n >= num_threads)
+  for (i = 0; i < n; i++) {
+    (pt+i)->fixed = 0.0;
+    (pt+i)->fixed = gbox(pt+i, pr + first_prism, fixed_model, fixed_index + first_prism, &blk);
+  }
+#endif
+}
+
+/*****************************************************************
+FUNCTION:  stream_load
+DESCRIPTION:  Makes this node's points from <first> on available in
+pt. When streaming, at most STREAM_POINTS of them are copied from the 
+mapped survey file; the pages just copied are released and the next
+points are read ahead while these are calculated. The field of the 
+prisms outside the mask is calculated on the first pass over the 
+points, and copied from stream_fixed after that. Otherwise all of the
+node's points are already in pt.
+INPUTS: (IN) long first  (the first point, from this node's first)
+OUTPUTS: long, the number of points now in pt (from pt[0])
+ ****************************************************************/
+static long stream_load(long first) {
+
+  long i, n = num_pts - first;
+
+  if ( !streaming ) return n;
+  if (n > STREAM_POINTS) n = STREAM_POINTS;
+  (void) load_points(stream_first + first, n, pt);
+  if (stream_fixed == NULL) fixed_field(n);
+  else if (first + n > stream_fixed_end) {
+    /* the first pass over these points; the fixed field is kept for the next ones */
+    fixed_field(n);
+    for (i = 0; i < n; i++) stream_fixed[first + i] = (pt+i)->fixed;
+    stream_fixed_end = first + n;
+  }
+  else for (i = 0; i < n; i++) (pt+i)->fixed = stream_fixed[first + i];
+  stream_advise(first, n, MADV_DONTNEED);
+  /* after the last points, the first ones are needed for the next evaluation */
+  stream_advise((first + n < num_pts) ? first + n : 0, STREAM_POINTS, MADV_WILLNEED);
+  return n;
+}
+
 /*****************************************************************
 FUNCTION:  get_points
 DESCRIPTION:  This function reads northing,easting coordinates 
@@ -295,115 +825,179 @@ into a POINTS array.
 The total number of points read are divided up between 
 nodes so that each node can calculate the magnetic field value at
 its portion of the points read.
+A text file is read once, by the master (see xyz_parser.c), which
+scatters the points to the other nodes; a binary survey file is 
+mapped by every node, which copies only its own points. With 
+STREAM_POINTS a node with more points than that keeps the file mapped 
+and copies its points in chunks during each evaluation (see 
+stream_load()), and the master does not keep a copy of every point.
 INPUTS: (IN) FILE *in  (file handle from which to read)
 OUTPUTS: int -1=error, 0=no error
  ****************************************************************/
 int get_points(FILE *in) {
   
-  char line[MAX_LINE]; /*maximum line read */ 
-  int i, ret;
+  int ret = 0;
+  long i;
+  long bytes; /* size of a text points file */
+  double start; /* when the master started reading a text points file */
   
-  int extra = 0; /* remaining points to calculate if total does not divide evenly amount nodes */
-  int my_start; /* starting line in points file (local) */
-  int pts_read = 0; /* number of points read so far (local) */
+  long extra = 0; /* remaining points to calculate if total does not divide evenly amount nodes */
+  long *group_ct; /* number of points of each point group */
+  long my_start; /* starting line in points file (local) */
+  long pts_read = 0; /* number of points read so far (local) */
 
  /* if (DEBUG == 2) fprintf(log_file, "ENTER[get_points]\n");*/
   
-  while (fgets(line, MAX_LINE, in) != NULL)  {
-  	if (line[0] == '#' || line[0] == '\n') continue;
-   total_pts++;
+  /* A binary survey file (see xyz2bin.c) is mapped rather than read */
+  if (open_survey(in)) {
+    fclose(in);
+    return -1;
   }
-  rewind(in);
-  fprintf(log_file, "  Total Number of points=%d\n", total_pts);
-  
-  /* Calculate number of points to calculate and starting line in file */
-  /* if total points does not divide equally among nodes let highest numbered node do the remainder */
-  extra = total_pts % procs;
-  if (extra) {
-  	num_pts = (int)(total_pts/procs);
-  	my_start = my_rank * num_pts;
-	if (my_rank == (procs -1)) num_pts += extra;
+  if (survey != NULL) total_pts = survey->count;
+  else if (STREAM_POINTS > 0) {
+    if ( !my_rank ) fprintf(stderr, "STREAM_POINTS needs a binary survey file (see xyz2bin)\n");
+    fclose(in);
+    return -1;
   }
   else {
-  	num_pts = (int)(total_pts/procs);
-  	my_start = my_rank * num_pts;
+    /* Only the master reads a text points file, the other nodes get their
+       points from it (see below) */
+    if ( !my_rank ) {
+      start = MPI_Wtime();
+      total_pts = read_xyz(in, num_threads, &p_all, &bytes);
+      start = MPI_Wtime() - start;
+      if (total_pts >= 0)
+        log_msg(LOG_INFO, "  Parsed %ld bytes in %.3f s (%.1f MB/s, %d threads)\n",
+                bytes, start, (start > 0.0) ? bytes / start / 1.0e6 : 0.0, num_threads);
+    }
+    MPI_Bcast(&total_pts, 1, MPI_LONG, 0, MPI_COMM_WORLD);
+    if (total_pts < 0) {
+      fclose(in);
+      return -1;
+    }
+  }
+  log_msg(LOG_INFO, "  Total Number of points=%ld\n", total_pts);
+  
+  /* The points are divided among the point groups (see setup_process_grid()). */
+  /* The size of these arrays of integers are based on the total number of nodes used. */
+  displ = (long *)arena_alloc((size_t)procs * sizeof(long));
+  recv_ct = (long *)arena_alloc((size_t)procs * sizeof(long));
+  group_ct = (long *)temp_alloc((size_t)ngroups * sizeof(long));
+  if (displ == NULL || recv_ct == NULL || group_ct == NULL) {
+    fprintf(stderr, "[%d-of-%d]\tCannot malloc memory for the point counts:[%s]\n",
+            my_rank, procs, strerror(errno));
+    fclose(in);
+    return -1;
   }
   
+  /* Calculate number of points to calculate and starting line in file */
+  /* if total points does not divide equally among point groups let the highest numbered group do the remainder */
+  extra = total_pts % ngroups;
+  for (i = 0; i < ngroups; i++) group_ct[i] = total_pts / ngroups;
+  group_ct[ngroups-1] += extra;
+  my_start = set_partition(group_ct);
+  temp_free(group_ct);
+  
   /* Allocate global storage for POINT structures being calculated. 
    * Only needs to be done on root node. 
    */
-  if ( !my_rank ) { /* code for master node */
-    p_all = (POINT *)GC_MALLOC((size_t)total_pts * sizeof(POINT));
+  if ( !my_rank && STREAM_POINTS <= 0 ) { /* code for master node */
+    if (p_all == NULL) p_all = (POINT *)arena_alloc((size_t)total_pts * sizeof(POINT));
     if (p_all == NULL) {
       fprintf(stderr, "[%d-of-%d]\tCannot malloc memory for all points:[%s]\n",
               my_rank, procs, strerror(errno));
       fclose(in);
       return -1;
     }
-    fprintf(log_file, "  TOTAL BYTE COUNT=%ld\n", 
-	    (total_pts * sizeof(POINT)) );
-    
-    /* The size of these arrays of integers are based on the total number of nodes used. */
-    displ = (int *)GC_MALLOC((size_t)procs * sizeof(int));
-    recv_ct = (int *)GC_MALLOC((size_t)procs * sizeof(int));
-    
-    /* For each node, calculate the total number of bytes of point storage needed */
-    displ[0] = 0;
-    // fprintf(stderr, "Total bytes of data = %ld\n", total_pts * sizeof(POINT));
-    for (i=0; i < procs; i++) {
-      recv_ct[i] = num_pts * sizeof(POINT);
-      if (extra) if (i == (procs-1)) recv_ct[i] = (num_pts + extra) * sizeof(POINT);
-      
-      /* Calculate each node's total byte displacement into the POINT array of data */
-      if (i>0) displ[i] = displ[i-1] + recv_ct[i-1];
-    /*  if (DEBUG==5) fprintf(stderr,"RECV_CT[%d]=%d bytes  DISPL[%d]= %d\n", i, recv_ct[i], i, displ[i]); */
-    }
+    log_msg(LOG_INFO, "  TOTAL BYTE COUNT=%lu\n", 
+	    (unsigned long)(total_pts * sizeof(POINT)) );
   } /* end code for master node */
   
   /* Allocate memory for each node's POINT structures (in bytes). */
-  my_count = num_pts * sizeof(POINT);
-  fprintf(log_file,"  MY BYTE COUNT=%d\n", my_count);
+  streaming = STREAM_POINTS > 0 && num_pts > STREAM_POINTS;
+  my_count = (streaming ? STREAM_POINTS : num_pts) * sizeof(POINT);
   
-  pt = (POINT *) GC_MALLOC((size_t)my_count);
+  pt = (POINT *)scratch_buffer(SCRATCH_POINTS, my_count + sizeof(POINT));
   if (pt == NULL) {
     fprintf(stderr, "[%d-of-%d]\tCannot malloc memory for points:[%s]\n",
             my_rank, procs, strerror(errno));
     fclose(in);
     return -1;
   }
-  fprintf(log_file,"  Number of points to calculate=%d\n\tStarting point=%d\n",
-	  num_pts, my_start);
+  /* A streamed point's field of the prisms outside the mask is kept apart from it */
+  if (streaming && num_fixed) {
+    stream_fixed = (double *)arena_alloc((size_t)num_pts * sizeof(double));
+    if (stream_fixed == NULL) {
+      fprintf(stderr, "[%d-of-%d]\tCannot malloc memory for the fixed field:[%s]\n",
+              my_rank, procs, strerror(errno));
+      fclose(in);
+      return -1;
+    }
+  }
+  /* A whole POINT, and the calculated value alone (stepping one POINT at a time) */
+  MPI_Type_contiguous((int)sizeof(POINT), MPI_BYTE, &MPI_POINT);
+  MPI_Type_commit(&MPI_POINT);
+  MPI_Type_create_resized(MPI_DOUBLE, 0, (MPI_Aint)sizeof(POINT), &MPI_CALC);
+  MPI_Type_commit(&MPI_CALC);
   
-  /* Each node reads from the points file  and stores its fraction of points to calculate */
-  /* for ( i = 0; i < total_pts; i++) { */
-  i=0;
-  while (i < total_pts) {
-    fgets(line, MAX_LINE, in);
-    if (line[0] == '#' || line[0] == '\n') continue;
-    else {
-      while (ret = sscanf(line, "%lf %lf %lf", 
-			 &(pt+pts_read)->easting, 
-			 &(pt+pts_read)->northing,
-			 &(pt+pts_read)->observed), 
-		  ret != 3) {
-		  	
-        if (ret == EOF && errno == EINTR) continue; 
-        fprintf(stderr, "[%d-of-%d]\t[line=%d,ret=%d] Did not read in 3 points:[%s]\n", 
-              my_rank, procs, i+1,ret, strerror(errno));
-        fclose(in);
-        return -1;
-      }
-      if ( i >= my_start ) {
-        pts_read++;
-        if (pts_read == num_pts) break;
+  if (HILBERT_ORDER || survey == NULL) {
+    /* The master reads every point, once, and scatters them to the point groups.
+       With HILBERT_ORDER the points are first sorted along a Hilbert curve,
+       and each point group gets a segment of the curve */
+    if ( !my_rank ) {
+      if (survey != NULL) ret = load_points(0, total_pts, p_all) != total_pts;
+      if (!ret && HILBERT_ORDER) {
+        place = (long *)arena_alloc((size_t)total_pts * sizeof(long));
+        if (place == NULL) {
+          fprintf(stderr, "[%d-of-%d]\tCannot malloc memory for the point order:[%s]\n",
+                  my_rank, procs, strerror(errno));
+          ret = 1;
+        }
+        else ret = hilbert_sort(p_all, total_pts, place);
       }
     }
-    i++;
- }
-  fprintf(log_file,"EXIT[get_points]:[%d-of-%d]Read %d points.\n", 
-	  my_rank, procs, pts_read);
+    fclose(in);
+    MPI_Bcast(&ret, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (ret) return -1;
+    if (ret = scatterv_long(p_all, recv_ct, displ, pt, recv_ct[my_rank], 
+                            MPI_POINT, 0, MPI_COMM_WORLD), ret) {
+      fprintf(stderr, "[%d-of-%d]\tCannot scatter points: ret=%d\n", my_rank, procs, ret);
+      return -1;
+    }
+    if (PRISM_BLOCKS > 1 && 
+        (ret = bcast_long(pt, num_pts, MPI_POINT, 0, row_comm), ret)) {
+      fprintf(stderr, "[%d-of-%d]\tCannot share points in point group %d: ret=%d\n", 
+              my_rank, procs, group, ret);
+      return -1;
+    }
+    pts_read = num_pts;
+  }
+  else {
+    /* Each node copies its fraction of points to calculate from the mapped survey file,
+       or streams them from it */
+    stream_first = my_start;
+    pts_read = streaming ? 0 : load_points(my_start, num_pts, pt);
+    fclose(in);
+    if (streaming) stream_advise(0, STREAM_POINTS, MADV_WILLNEED);
+    
+    /* The master keeps a copy of every point's location and observed value,
+       for printing out the calculated values. */
+    if (STREAM_POINTS <= 0 && (ret = gatherv_long(pt, recv_ct[my_rank], p_all, recv_ct, displ, MPI_POINT, 
+                           0, MPI_COMM_WORLD), ret)) {
+      fprintf(stderr, "[%d-of-%d]\tCannot gather points: ret=%d\n", my_rank, procs, ret);
+      return -1;
+    }
+  }
+  if ( !streaming ) fixed_field(num_pts);
+  if (survey != NULL && !streaming) {
+    munmap(survey, survey_bytes);
+    survey = NULL;
+  }
+  /* one line for each node, in the master's log */
+  log_summary("points %ld from %ld (%lu bytes), read %ld%s", 
+              num_pts, my_start, (unsigned long)my_count, pts_read, streaming ? ", streamed" : "");
   fflush(log_file);
-  fclose(in);
+  start_time = MPI_Wtime();
   return 0;
 }
 
@@ -412,10 +1006,12 @@ int get_points(FILE *in) {
 FUNCTION:  setup_prisms
 DESCRIPTION:  
 INPUTS: 
-OUTPUTS: int 
+OUTPUTS: int number of prisms whose depth is a parameter, -1=error
 ***************************************************************/
 int setup_prisms(void) {
   int count, x, y, i;
+  int active; /* number of prisms whose depth is a parameter */
+  int masked; /* number of interior prisms outside the mask */
   double xmin, ymax; /*ymin*/
 
     /* if (DEBUG == 2) fprintf(log_file,"ENTER[setup_prisms]\n"); */
@@ -426,19 +1022,25 @@ int setup_prisms(void) {
      
     P.N_units = P.row * P.col;
   
-    fprintf(log_file, 
+    log_msg(LOG_INFO, 
 	    "Number of rows = %d\nNumber of cols = %d\nNumber of Prisms = %d\n", 
 	    P.row, P.col, P.N_units);
   
-    pr = (PRISM *)GC_MALLOC((size_t)P.N_units * sizeof(PRISM));
-    if (pr == NULL) {
+    /* The prism outlines never change, so one copy is kept per compute node;
+       the depths change with every evaluation and are kept by each process */
+    pr = (PRISM *)shared_alloc((size_t)P.N_units * sizeof(PRISM));
+    depth_index = (int *)shared_alloc((size_t)P.N_units * sizeof(int));
+    bottom = (double *)arena_alloc((size_t)P.N_units * sizeof(double));
+    if (pr == NULL || depth_index == NULL || bottom == NULL) {
       fprintf(stderr, "[%d-of-%d]\tCannot malloc memory for prisms:[%s]\n",
             my_rank, procs, strerror(errno));
       return -1;
     } 
+    for (i = 0; i < P.N_units; i++) bottom[i] = 1.0;
     
     count = 0;
     /* for ( ymin = P.min_northing, y = 0; y < P.row; ymin += P.sp, y++) {*/
+    if (is_node_root())
     for (ymax = P.max_northing, y = 0; y < P.row; ymax -= P.sp, y++) {
       for ( xmin = P.min_easting, x = 0; x < P.col; xmin += P.sp, x++) {
         /*(pr+count)->south = ymin+.0001;*/
@@ -447,136 +1049,831 @@ int setup_prisms(void) {
         /*(pr+count)->north = ymin + P.sp + .0001;*/
         (pr+count)->west = xmin+.0001;
         (pr+count)->east = xmin + P.sp + .0001;
-        (pr+count)->depth_to_bottom = 1.0;
         count++;
       }
     }
+    
+    /* The interior prisms outside the mask are fixed at MASK_DEPTH; when that
+       gives them a thickness their field is calculated once (see fixed_field()),
+       which needs a fixed depth to top */
+    if ((masked = mask_prisms(pr, P)) < 0) return -1;
+    if (masked && MASK_DEPTH != HUGE_VAL && MASK_DEPTH != _LO[DEPTH_TO_TOP]) {
+      if (_LO[DEPTH_TO_TOP] != _HI[DEPTH_TO_TOP]) {
+        fprintf(stderr, "[%d-of-%d]\tMASK_DEPTH needs MIN_DEPTH_TO_TOP = MAX_DEPTH_TO_TOP\n",
+                my_rank, procs);
+        return -1;
+      }
+      num_fixed = masked;
+      fixed_model[DEPTH_TO_TOP] = _LO[DEPTH_TO_TOP];
+      fixed_model[DENSITY] = 1.0;
+      fixed_model[DEPTH_TO_BOT] = MASK_DEPTH;
+      fixed_index = (int *)shared_alloc((size_t)P.N_units * sizeof(int));
+      if (fixed_index == NULL) return -1;
+      if (is_node_root())
+        for (i = 0; i < P.N_units; i++) 
+          fixed_index[i] = ((pr+i)->b == CELL_MASKED) ? DEPTH_TO_BOT : DEPTH_TO_TOP;
+    }
+    if (is_node_root()) (void) create_index(depth_index, pr, P);
+    shared_sync();
+    active = create_index(NULL, pr, P);
+    if (masked) 
+      log_msg(LOG_INFO, "%d interior prisms are outside the mask, fixed at %s\n", masked, 
+              num_fixed ? "MASK_DEPTH" : "the depth to top");
   
-    for (i = 0; i < count; i++) {
-      fprintf (log_file, "[%d]: %f to %f,  %f to %f\n", i,
+    /* one line per prism, so only at LOG_DEBUG */
+    if (LOG_LEVEL >= LOG_DEBUG)
+    for (i = 0; i < P.N_units; i++) {
+      log_msg(LOG_DEBUG, "[%d]: %f to %f,  %f to %f\n", i,
       (pr+i)->west,
 	     (pr+i)->east,
 	     (pr+i)->south,
 	     (pr+i)->north);
     }     		
-    fflush(log_file);
-   return P.N_units;
+   return active;
 }
   
+/**************************************************************
+FUNCTION:  sum_squares
+DESCRIPTION:  The sum of the squared errors of the first <n> points
+in pt.
+INPUTS: (IN) long n  (number of points)
+OUTPUTS: double sum of squared errors 
+***************************************************************/
+static double sum_squares(long n) {
+  long i;
+  double ss=0.0, error;
+  
+  for (i=0; i < n; i++) {
+  	 error = (pt+i)->calculated - (pt+i)->observed; 
+    ss += (error*error);
+  }
+  return ss;
+}
+
 /**************************************************************
 FUNCTION:  rmse
 DESCRIPTION:  
-INPUTS: NONE
+INPUTS: double ss (the sum of squared errors over all nodes)
 OUTPUTS: double rmse 
 ***************************************************************/
-double rmse(void) {
-  int i;
-  double rmse=0.0, error;
+double rmse(double ss) {
+  double rmse;
   
-  for (i=0; i < total_pts; i++) {
-  	 error = (p_all+i)->calculated - (p_all+i)->observed; 
-    rmse += (error*error);
-  }
-  rmse /= (total_pts);
+  rmse = ss / (total_pts);
   rmse = sqrt(rmse);
   return rmse;
 }
 
 /*****************************************************************
-FUNCTION: minimizing_func
-DESCRIPTION: this is where the nodes assign new parameter values 
-to the prisms, calculate new magnetic values and compare the
-calculated value with the observed value using the chi-squared test. 
-INPUTS: (IN)  double param[]  (an array of new prism parameters) 
-RETURN:  double, the result of the rmse or chi-squared test
+FUNCTION: wait_idle
+DESCRIPTION: Waits for a non-blocking operation to complete; the 
+time spent waiting is counted as idle time.
+INPUTS: (IN/OUT) MPI_Request *req
+RETURN:  int, MPI_SUCCESS or an MPI error code
  *****************************************************************/
-double minimizing_func(double param[]) {
+static int wait_idle(MPI_Request *req) {
+  int ret;
+  double start = MPI_Wtime();
 
-  int i, ret;
-  double fit;
-  
- /* if (DEBUG == 2) fprintf(log_file, "  ENTER[minimizing_func]node=%d\n", my_rank); */
- // fprintf(stderr, "  ENTER[minimizing_func]node=%d\n", my_rank);
-  
-  if ( !my_rank ) {
-      
-    /* Send the updated parameters to the slave nodes */  
-    
-    for (i = 1; i < procs; i++) {
-    	//fprintf(stderr, "  \tSending %d parameters to node %dof%d .. ",(int)NUM_OF_PARAMS, i, procs);
-      ret = MPI_Send((void *)param, NUM_OF_PARAMS, MPI_DOUBLE, i, 0, MPI_COMM_WORLD);
-    /*  if (DEBUG == 2) fprintf(stderr, "  \tParameters sent to node %d, MPIret=%d\n", i, ret); */
-   // fprintf(stderr, "  Parameters sent to node %d, MPIret=%d\n", i, ret);
-    }
-  }
+  ret = MPI_Wait(req, MPI_STATUS_IGNORE);
+  idle_time += MPI_Wtime() - start;
+  return ret;
+}
 
+/*****************************************************************
+FUNCTION: dump_complete
+DESCRIPTION: Completes the gather of a dumped text field (see 
+dump_field()), waiting for it if <wait> is set, else only checking on
+it. Once the gather has completed the master hands the snapshot to 
+the output writer.
+INPUTS: (IN) int wait  (1=wait for the gather, 0=only check)
+RETURN:  none
+ *****************************************************************/
+static void dump_complete(int wait) {
+  int done = 1;
 
-  /* Every node assigns the new parameters to their copy of the array of PRISM's */
-  assign_new_params( param );
-    
- /* Every node can now calculate A gbox (gravity) value for each of their subset of POINTs */ 
-  for (i = 0;  i < num_pts;  i++) {
-      (pt+i)->calculated = gbox(pt+i, pr, &P);  
-  }
-  
-  /* Gather all of the calculated gravity values from each node into a single POINT array.
-     This MPI function orders the bytes of data from each node in rank order (0, 1, etc).
-     
-     fprintf(stderr, "[NODE_%d] my_count=%d, my_data=%d bytes p_all=%d bytes\n",
-     my_rank, my_count, (int)sizeof recv_ct, (int)sizeof p_all);
-  */
-  if (ret = MPI_Gatherv(pt, /* address of each proc's BYTE array of data */
-			my_count, /* number of BYTES of data from each node */
-			MPI_BYTE, /* data_type of each unit of sent of data */
-			p_all, /* address of global point array */
-			recv_ct, /* address of array of received data */
-			displ, /* array of received displacements */
-			MPI_BYTE, /* received datatype */
-			0, /* root proc */
-			MPI_COMM_WORLD), !ret)	{
-				
-      if ( !my_rank ) {
-	  /* Only the master node calculates a new goodness-of-fit value */
-	  
-	     fit = rmse();
-      } else 
-	     fit = 0.0;
-  }
-  else {
-      fprintf(stderr, "ERROR: ret=%d\n", ret);
-      return 0.0;
+  if (dump_req == MPI_REQUEST_NULL && dump_snap == NULL) return;
+  if (wait) (void) wait_idle(&dump_req);
+  else (void) MPI_Test(&dump_req, &done, MPI_STATUS_IGNORE);
+  if (done && dump_snap != NULL) {
+    writer_post(dump_snap);
+    dump_snap = NULL;
   }
-/*  if (DEBUG == 2) fprintf(log_file, "  EXIT[minimizing_func]\t[%d-of-%d] ret=%f\n\n", 
-			  my_rank, procs, fit); */
-  return fit;
 }
 
-/****************************************************************** 
-FUNCTION:  assign_new_params
-The function assigns updated parameter values to the anomaly being modeled.
-This happens before each calulation of the magnetic value.
-INPUTS: (IN)  double param[]  (an array of new prism parameters to be tested) 
+/*****************************************************************
+FUNCTION: dump_finish
+DESCRIPTION: Called by every node when the inversion is done (the 
+master before it stops the output writer): the last dump is completed.
+INPUTS: none
 RETURN:  none
-*******************************************************************/
-/* void assign_new_params( double param[]) { */
-void assign_new_params(double param[]) {
+ *****************************************************************/
+void dump_finish(void) {
+  dump_complete(1);
+}
+
+/*****************************************************************
+FUNCTION: note_best
+DESCRIPTION: Run by the master after each evaluation of a parameter
+set. If the set is the best model so far it is copied, and the nodes
+are told with the next command to keep its calculated values (see
+keep_best()).
+INPUTS: (IN) const double m[]  (the model, as prism depths)
+        (IN) double fit  (its RMSE)
+        (IN) int k  (the set within the evaluation)
+RETURN:  none
+ *****************************************************************/
+static void note_best(const double m[], double fit, int k) {
+
+  if (fit >= best_fit || best_model == NULL) return;
+  best_fit = fit;
+  if (best_model != m) memcpy(best_model, m, (size_t)num_depths * sizeof(double));
+  best_set = k;
+}
+
+/*****************************************************************
+FUNCTION: keep_best
+DESCRIPTION: Copies the calculated values of parameter set <k> of
+this node's last evaluation to POINT.best, where they stay until a
+better model is evaluated; a dump then needs neither another
+evaluation nor the calculated values of the last one. Every node 
+calls it when the master announces a better model with a command
+(see send_command()). Streamed points keep nothing.
+INPUTS: (IN) int k  (the set, -1 = none)
+RETURN:  none
+ *****************************************************************/
+static void keep_best(int k) {
+  long i;
+
+  if (k < 0 || streaming) return;
+  /* this node's part of a dumped field may still be on its way to the master */
+  dump_complete(1);
+  if (last_sets == 1)
+    for (i = 0; i < num_pts; i++) (pt+i)->best = (pt+i)->calculated;
+  else 
+    for (i = 0; i < num_pts; i++) (pt+i)->best = batch_calc[i * last_sets + k];
+}
+
+/*****************************************************************
+FUNCTION: finish_pending
+DESCRIPTION: A slave node does not wait for its part of the sum of
+squares reduction to complete; it goes on to wait for the master's
+next command. The reduction is completed here, before its send buffer
+is used again.
+INPUTS: none
+RETURN:  none
+ *****************************************************************/
+static void finish_pending(void) {
+  dump_complete(0);
+  if (pending == MPI_REQUEST_NULL) return;
+  phase_begin(PHASE_REDUCE);
+  (void) wait_idle(&pending);
+  phase_end();
+}
+
+/*****************************************************************
+FUNCTION: report_idle
+DESCRIPTION: Called by every node at the end of the run. Writes each
+node's idle fraction (the time spent waiting for the master or for
+other nodes, over the time since the points were read) to the 
+master's log file.
+INPUTS: none
+RETURN:  none
+ *****************************************************************/
+void report_idle(void) {
+  double mine[2], *all = NULL;
+  int i;
+
+  finish_pending();
+  mine[0] = idle_time;
+  mine[1] = MPI_Wtime() - start_time;
+  if ( !my_rank ) all = (double *)scratch_buffer(SCRATCH_BALANCE, (size_t)procs * 2 * sizeof(double));
+  MPI_Gather(mine, 2, MPI_DOUBLE, all, 2, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  if ( !my_rank && all != NULL )
+    for (i = 0; i < procs; i++)
+      log_msg(LOG_SUMMARY, "[report_idle] node %d idle %.3f of %.3f seconds (%.1f%%)\n",
+              i, all[2*i], all[2*i+1], 
+              (all[2*i+1] > 0.0) ? 100.0 * all[2*i] / all[2*i+1] : 0.0);
+}
 
-  int num, row, col;
+/**************************************************************
+FUNCTION:  send_command
+DESCRIPTION:  The master broadcasts what the slave nodes do next
+(see slave()). Every command is three integers: the command, the 
+number of parameter sets that follow (CMD_EVAL, CMD_BATCH), and which
+parameter set of the last evaluation is the best model so far, if one
+is (see keep_best()).
+INPUTS: (IN) int cmd  (CMD_QUIT, CMD_EVAL, CMD_BATCH, CMD_GATHER)
+        (IN) int count  (number of parameter sets)
+OUTPUTS: none 
+***************************************************************/
+void send_command(int cmd, int count) {
+  int buf[3];
   
- P.density = param[DENSITY]; 
- P.depth_to_top = param[DEPTH_TO_TOP]; 
- 
-  /* assign the new parameters to the grid and calculate the grid border */
-  create_grid(param, GRID, P);
-  
-  /* Now assign the new GRID values back to the prism model */    
-  num = 0;
-    for (row = 0; row < P.row; row++) {
-      for (col = 0; col < P.col; col++) {
-	     (pr+num)->depth_to_bottom = GRID[row][col];
-	     num++;       
+  buf[0] = cmd;
+  buf[1] = count;
+  buf[2] = best_set;
+  phase_begin(PHASE_SEND);
+  MPI_Bcast(buf, 3, MPI_INT, 0, MPI_COMM_WORLD);
+  phase_end();
+  keep_best(best_set);
+  best_set = -1;
+}
+
+/**************************************************************
+FUNCTION:  recv_command
+DESCRIPTION:  The slave nodes wait for the master's next command.
+INPUTS: (OUT) int *cmd
+        (OUT) int *count 
+OUTPUTS: none 
+***************************************************************/
+void recv_command(int *cmd, int *count) {
+  int buf[3] = {CMD_QUIT, 0, -1};
+  double start = MPI_Wtime();
+  
+  phase_begin(PHASE_SEND);
+  MPI_Bcast(buf, 3, MPI_INT, 0, MPI_COMM_WORLD);
+  phase_end();
+  idle_time += MPI_Wtime() - start;
+  keep_best(buf[2]);
+  *cmd = buf[0];
+  *count = buf[1];
+}
+
+/**************************************************************
+FUNCTION:  gather_calculated
+DESCRIPTION:  Gathers the calculated values (only) of every point
+group's points into the master's POINT array. Called by every node; the 
+master first sends CMD_GATHER (see printout_points()).
+INPUTS: none
+OUTPUTS: none 
+***************************************************************/
+void gather_calculated(void) {
+  int ret;
+  
+  finish_pending();
+  if (ret = gatherv_long(&pt->calculated, recv_ct[my_rank],
+                         (p_all == NULL) ? NULL : &p_all->calculated, recv_ct, displ, MPI_CALC,
+                         0, MPI_COMM_WORLD), ret)
+    fprintf(stderr, "[%d-of-%d]\tCannot gather calculated values: ret=%d\n", my_rank, procs, ret);
+}
+
+/*****************************************************************
+FUNCTION: balance_check
+DESCRIPTION: Run by the master before each evaluation. Every 
+REBALANCE_INTERVAL evaluations the slave nodes are told to 
+repartition the points (see rebalance_points()).
+INPUTS: (IN) int K  (number of parameter sets about to be evaluated)
+RETURN:  none
+ *****************************************************************/
+static void balance_check(int K) {
+
+  if (REBALANCE_INTERVAL <= 0 || ngroups < 2) return;
+  if (evals_since_balance >= REBALANCE_INTERVAL) {
+    send_command(CMD_REBALANCE, 0);
+    rebalance_points();
+    evals_since_balance = 0;
+  }
+  evals_since_balance += K;
+}
+
+/*****************************************************************
+FUNCTION: rebalance_points
+DESCRIPTION: Repartitions the points among the point groups in 
+proportion to the speed each group has shown since the last 
+repartition, so that all nodes finish an evaluation at about the same
+time. A point group is as fast as its slowest node. The points stay
+in file order; each group still gets a contiguous range. Every node
+calls this function (the master sends CMD_REBALANCE first). The master
+holds every point and scatters the new ranges to the group leaders,
+which pass them on to the rest of their group.
+
+The imbalance ratio (slowest group's calculating time / mean time) is
+written to the log for the period just measured, together with the
+ratio predicted for the new partition.
+INPUTS: none
+RETURN:  int 1=error, 0=no error
+ *****************************************************************/
+int rebalance_points(void) {
+
+  double mine[2]; /* this node's calculating time and number of point evaluations */
+  double *all; /* every node's time and number of point evaluations */
+  double *time; /* every point group's time (that of its slowest node) */
+  double *rate; /* every point group's speed (points/second) */
+  double *share; /* every point group's share of the points */
+  double sum_time = 0.0, max_time = 0.0, sum_rate = 0.0, predicted = 0.0;
+  int i, g, ret, known = 0;
+  long assigned;
+  long *count; /* every point group's new number of points */
+
+  /* one scratch buffer, reused by every repartition */
+  all = (double *)scratch_buffer(SCRATCH_BALANCE, 
+                                 (size_t)(2 * procs + 3 * ngroups) * sizeof(double) + (size_t)ngroups * sizeof(long));
+  if (all == NULL) {
+    fprintf(stderr, "[%d-of-%d]\tCannot malloc memory for rebalancing:[%s]\n",
+            my_rank, procs, strerror(errno));
+    return 1;
+  }
+  time = all + 2 * procs;
+  rate = time + ngroups;
+  share = rate + ngroups;
+  count = (long *)(share + ngroups);
+
+  finish_pending();
+  mine[0] = work_time;
+  mine[1] = work_points;
+  MPI_Allgather(mine, 2, MPI_DOUBLE, all, 2, MPI_DOUBLE, MPI_COMM_WORLD);
+  work_time = 0.0;
+  work_points = 0.0;
+
+  for (g = 0; g < ngroups; g++) {
+    time[g] = 0.0;
+    for (i = g * PRISM_BLOCKS; i < (g + 1) * PRISM_BLOCKS; i++)
+      if (all[2*i] > time[g]) time[g] = all[2*i];
+    rate[g] = (time[g] > 0.0 && all[2*g*PRISM_BLOCKS+1] > 0.0) ? 
+              all[2*g*PRISM_BLOCKS+1] / time[g] : 0.0;
+    sum_time += time[g];
+    if (time[g] > max_time) max_time = time[g];
+    if (rate[g] > 0.0) {
+      sum_rate += rate[g];
+      known++;
+    }
+  }
+  if (!known || sum_time <= 0.0) return 0;
+
+  /* Moving the points is not worth it for a small imbalance */
+  if (max_time / (sum_time / ngroups) < REBALANCE_THRESHOLD) {
+    if ( !my_rank ) 
+      log_msg(LOG_INFO, "[rebalance_points] imbalance ratio (max/mean) was %.3f, points not moved\n",
+              max_time / (sum_time / ngroups));
+    return 0;
+  }
+
+  /* A point group that had no points is assumed to be as fast as the average group */
+  for (g = 0; g < ngroups; g++)
+    if (rate[g] <= 0.0) rate[g] = sum_rate / known;
+  for (sum_rate = 0.0, g = 0; g < ngroups; g++) sum_rate += rate[g];
+
+  /* Every node computes the same new partition */
+  for (assigned = 0, g = 0; g < ngroups; g++) {
+    share[g] = total_pts * rate[g] / sum_rate;
+    count[g] = (long)share[g];
+    assigned += count[g];
+  }
+  /* hand out the rounding remainder, largest fractions first */
+  while (assigned < total_pts) {
+    int most = 0;
+    for (g = 1; g < ngroups; g++)
+      if (share[g] - count[g] > share[most] - count[most]) most = g;
+    count[most]++;
+    share[most] = count[most];
+    assigned++;
+  }
+  for (g = 0; g < ngroups; g++)
+    if ((double)count[g] / rate[g] > predicted) predicted = (double)count[g] / rate[g];
+  predicted /= (double)total_pts / sum_rate;
+
+  if ( !my_rank ) 
+    log_msg(LOG_INFO, "[rebalance_points] imbalance ratio (max/mean) was %.3f, now about %.3f\n",
+            max_time / (sum_time / ngroups), predicted);
+
+  /* The kept best field moves with the points; a dump still being gathered must finish first */
+  dump_complete(1);
+  if (ret = gatherv_long(&pt->best, recv_ct[my_rank], (p_all == NULL) ? NULL : &p_all->best, 
+                         recv_ct, displ, MPI_CALC, 0, MPI_COMM_WORLD), ret) {
+    fprintf(stderr, "[%d-of-%d]\tCannot gather the best field: ret=%d\n", my_rank, procs, ret);
+    return 1;
+  }
+
+  /* Move the points to their new point groups */
+  (void) set_partition(count);
+  my_count = num_pts * sizeof(POINT);
+  pt = (POINT *)scratch_buffer(SCRATCH_POINTS, my_count + sizeof(POINT));
+  if (pt == NULL) {
+    fprintf(stderr, "[%d-of-%d]\tCannot malloc memory for points:[%s]\n",
+            my_rank, procs, strerror(errno));
+    return 1;
+  }
+  if (ret = scatterv_long(p_all, recv_ct, displ, pt, recv_ct[my_rank], 
+                          MPI_POINT, 0, MPI_COMM_WORLD), ret) {
+    fprintf(stderr, "[%d-of-%d]\tCannot scatter points: ret=%d\n", my_rank, procs, ret);
+    return 1;
+  }
+  if (PRISM_BLOCKS > 1 && 
+      (ret = bcast_long(pt, num_pts, MPI_POINT, 0, row_comm), ret)) {
+    fprintf(stderr, "[%d-of-%d]\tCannot share points in point group %d: ret=%d\n", 
+            my_rank, procs, group, ret);
+    return 1;
+  }
+  fixed_field(num_pts);
+  log_summary("[rebalance_points] points %ld from %ld", num_pts, displ[group * PRISM_BLOCKS]);
+
+  /* the batch storage and the binary field layout depend on the points */
+  batch_calc = NULL;
+  write_order = NULL;
+  write_disp = NULL;
+  return 0;
+}
+
+/*****************************************************************
+FUNCTION: alloc_batch
+DESCRIPTION: Allocates the storage used by minimizing_func_batch()
+for BATCH_SIZE parameter sets. The calculated values depend on the 
+number of points, so they are fetched again after the points are 
+repartitioned; their scratch buffer only grows. The rest is allocated
+once, on first use.
+INPUTS: none
+RETURN:  int 1=error, 0=no error
+ *****************************************************************/
+static int alloc_batch(void) {
+
+  batch_calc = (double *)scratch_buffer(SCRATCH_BATCH, 
+                 (size_t)BATCH_SIZE * (streaming ? STREAM_POINTS : num_pts) * sizeof(double));
+  if (batch_ss == NULL) batch_ss = (double *)arena_alloc((size_t)BATCH_SIZE * sizeof(double));
+  if (batch_sum == NULL) batch_sum = (double *)arena_alloc((size_t)BATCH_SIZE * sizeof(double));
+  if (PARAMETERIZATION == PARAM_BSPLINE && batch_depths == NULL)
+    batch_depths = (double *)arena_alloc((size_t)BATCH_SIZE * num_depths * sizeof(double));
+  if (batch_calc == NULL || batch_ss == NULL || batch_sum == NULL ||
+      (PARAMETERIZATION == PARAM_BSPLINE && batch_depths == NULL)) {
+    fprintf(stderr, "[%d-of-%d]\tCannot malloc memory for batch evaluation:[%s]\n",
+            my_rank, procs, strerror(errno));
+    return 1;
+  }
+  return 0;
+}
+
+#ifdef NO_MPI
+/* the arguments of calc_points_batch() */
+typedef struct batch_job {
+  PARAMETER *pa; /* the parameters, for this node's block of prisms */
+  const double *params; /* the parameter sets (expanded, see minimizing_func_batch()) */
+  int stride; /* length of each set */
+  int K; /* number of parameter sets */
+} BATCH_JOB;
+
+/*****************************************************************
+FUNCTION: calc_points
+DESCRIPTION: The point loop of minimizing_func() in the threads-only
+build, run by pool_for() for a chunk of the points.
+INPUTS: (IN) long begin, end  (the chunk of points)
+        (IN) void *arg  (PARAMETER *, for this node's block of prisms)
+RETURN:  none
+ *****************************************************************/
+static void calc_points(long begin, long end, void *arg) {
+  long i;
+
+  for (i = begin; i < end; i++)
+    (pt+i)->calculated = gbox(pt+i, pr + first_prism, model, depth_index + first_prism, (PARAMETER *)arg);
+}
+
+/*****************************************************************
+FUNCTION: calc_points_batch
+DESCRIPTION: The point loop of minimizing_func_batch() in the 
+threads-only build, run by pool_for() for a chunk of the points.
+INPUTS: (IN) long begin, end  (the chunk of points)
+        (IN) void *arg  (BATCH_JOB *)
+RETURN:  none
+ *****************************************************************/
+static void calc_points_batch(long begin, long end, void *arg) {
+  BATCH_JOB *job = (BATCH_JOB *)arg;
+  long i;
+
+  for (i = begin; i < end; i++)
+    gbox_batch(pt+i, pr + first_prism, job->pa, job->K, job->params, job->stride,
+               depth_index + first_prism, batch_calc + i * job->K);
+}
+#endif
+
+/*****************************************************************
+FUNCTION: calc_chunk
+DESCRIPTION: Calculates the field of this node's block of prisms at 
+the first <n> points in pt. The points are shared among the node's 
+threads when there are enough of them; otherwise gbox() may share out
+the prisms instead.
+INPUTS: (IN) long n  (number of points)
+        (IN) PARAMETER *blk  (the parameters, for this node's block of prisms)
+RETURN:  none
+ *****************************************************************/
+static void calc_chunk(long n, PARAMETER *blk) {
+  double start = MPI_Wtime();
+#ifdef NO_MPI
+  phase_begin(PHASE_COMPUTE);
+  pool_for(n, calc_points, blk);
+#else
+  long i;
+
+  phase_begin(PHASE_COMPUTE);
+#pragma omp parallel for schedule(static) if (n >= num_threads)
+  for (i = 0;  i < n;  i++) {
+      (pt+i)->calculated = gbox(pt+i, pr + first_prism, model, depth_index + first_prism, blk);  
+  }
+#endif
+  phase_end();
+  work_time += MPI_Wtime() - start;
+  work_points += n;
+}
+
+/*****************************************************************
+FUNCTION: sum_blocks
+DESCRIPTION: The point group's leader adds up the fields of all prism
+blocks at the first <n> points in pt (MPI_SUM needs them in a 
+contiguous array, the batch storage is used). Called by every node of
+the point group.
+INPUTS: (IN) long n  (number of points)
+RETURN:  int, MPI_SUCCESS or an error code
+ *****************************************************************/
+static int sum_blocks(long n) {
+  long i;
+  int ret;
+  double start;
+
+  if (PRISM_BLOCKS < 2) return 0;
+  if (batch_calc == NULL && alloc_batch()) return 1;
+  for (i = 0; i < n; i++) batch_calc[i] = (pt+i)->calculated;
+  start = MPI_Wtime();
+  phase_begin(PHASE_REDUCE);
+  ret = reduce_sum_long(block ? batch_calc : MPI_IN_PLACE, batch_calc, n, 0, row_comm);
+  phase_end();
+  idle_time += MPI_Wtime() - start;
+  if ( !ret ) for (i = 0; i < n; i++) (pt+i)->calculated = batch_calc[i];
+  return ret;
+}
+
+/*****************************************************************
+FUNCTION: minimizing_func
+DESCRIPTION: this is where the nodes assign new parameter values 
+to the prisms, calculate new magnetic values and compare the
+calculated value with the observed value using the chi-squared test. 
+INPUTS: (IN)  double param[]  (an array of new prism parameters) 
+RETURN:  double, the result of the rmse or chi-squared test
+ *****************************************************************/
+double minimizing_func(double param[]) {
+
+  long first, n;
+  int ret;
+  double fit, ss_all = 0.0;
+  PARAMETER blk; /* the parameters, for this node's block of prisms */
+  MPI_Request req;
+  
+ /* if (DEBUG == 2) fprintf(log_file, "  ENTER[minimizing_func]node=%d\n", my_rank); */
+ // fprintf(stderr, "  ENTER[minimizing_func]node=%d\n", my_rank);
+  
+  finish_pending();
+  if ( !my_rank ) balance_check(1);
+  
+  /* The master tells the slave nodes to evaluate one parameter set
+     and broadcasts the updated parameters to them. The master does not
+     wait for the broadcast; it goes on to calculate its own points. */
+  if ( !my_rank ) send_command(CMD_EVAL, 1);
+  phase_begin(PHASE_SEND);
+  MPI_Ibcast(param, NUM_OF_PARAMS, MPI_DOUBLE, 0, MPI_COMM_WORLD, &req);
+  if (my_rank || !NONBLOCKING) (void) wait_idle(&req);
+  phase_end();
+
+  /* Every node assigns the new parameters to their copy of the array of PRISM's */
+  assign_new_params( param );
+    
+ /* Every node can now calculate A gbox (gravity) value for each of their subset of POINTs,
+    from their block of prisms, a chunk at a time when the points are streamed */ 
+  blk = P;
+  blk.N_units = num_prisms;
+  ss_send = 0.0;
+  first = 0;
+  do {
+    n = stream_load(first);
+    calc_chunk(n, &blk);
+    
+    if ( !my_rank && NONBLOCKING ) {
+      phase_begin(PHASE_SEND);
+      (void) wait_idle(&req);
+      phase_end();
+    }
+  
+    /* The point group's leader adds up the fields of all prism blocks */
+    if (ret = sum_blocks(n), ret) {
+      fprintf(stderr, "ERROR: ret=%d\n", ret);
+      return 0.0;
+    }
+    phase_begin(PHASE_RMSE);
+    ss_send += block ? 0.0 : sum_squares(n);
+    phase_end();
+    first += n;
+  } while (first < num_pts);
+  
+  /* Only the sums of squared errors are sent to the master, which calculates the
+     new goodness-of-fit value. The calculated values stay on each node until 
+     they are printed out (see gather_calculated()). The slave nodes do not
+     wait for the reduction to complete (see finish_pending()). */
+  phase_begin(PHASE_REDUCE);
+  ret = MPI_Ireduce(&ss_send, &ss_all, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD, &pending);
+  phase_end();
+  if (ret) {
+      fprintf(stderr, "ERROR: ret=%d\n", ret);
+      return 0.0;
+  }
+  if ( !my_rank || !NONBLOCKING ) finish_pending();
+  phase_begin(PHASE_RMSE);
+  fit = ( !my_rank ) ? rmse(ss_all) : 0.0;
+  phase_end();
+  last_sets = 1;
+  if ( !my_rank ) note_best(model, fit, 0);
+/*  if (DEBUG == 2) fprintf(log_file, "  EXIT[minimizing_func]\t[%d-of-%d] ret=%f\n\n", 
+			  my_rank, procs, fit); */
+  return fit;
+}
+
+/*****************************************************************
+FUNCTION: minimizing_func_batch
+DESCRIPTION: Evaluates K parameter sets in one pass over this node's
+points. Each point's location and the prism outlines are loaded once
+and used for all K models (see gbox_batch()). The K sums of squared
+errors are reduced to the master, which returns the K goodness-of-fit
+values. Each value is identical to what minimizing_func() returns for
+the same parameter set; afterwards the prisms and the calculated values
+hold the last parameter set, as if the K sets had been evaluated one
+after another.
+INPUTS: (IN)  double params[]  (K parameter sets, one after another)
+        (IN)  int K  (number of parameter sets, at most BATCH_SIZE)
+        (OUT) double fit[]  (the rmse of each parameter set, master only)
+RETURN:  none
+ *****************************************************************/
+void minimizing_func_batch(double params[], int K, double fit[]) {
+
+  long i, first, n;
+  int k, ret;
+  double error, start;
+  PARAMETER blk; /* the parameters, for this node's block of prisms */
+  MPI_Request req;
+  const double *sets = params; /* the parameter sets, as prism depths */
+  int stride = NUM_OF_PARAMS; /* length of each of them */
+#ifdef NO_MPI
+  BATCH_JOB job;
+#endif
+
+  finish_pending();
+  if ( !my_rank ) balance_check(K);
+
+  if (batch_calc == NULL && alloc_batch()) {
+    for (k = 0; k < K; k++) fit[k] = 0.0;
+    return;
+  }
+
+  /* Send all of the parameter sets to the slave nodes at once; the master
+     does not wait for the broadcast before it starts calculating */
+  if ( !my_rank ) send_command(CMD_BATCH, K);
+  phase_begin(PHASE_SEND);
+  MPI_Ibcast(params, K * NUM_OF_PARAMS, MPI_DOUBLE, 0, MPI_COMM_WORLD, &req);
+  if (my_rank || !NONBLOCKING) (void) wait_idle(&req);
+  phase_end();
+
+  /* gbox_batch() reads each set's depths straight from params (or from
+     their expansion); afterwards the model is the last set */
+  if (PARAMETERIZATION == PARAM_BSPLINE) {
+    for (k = 0; k < K; k++) basis_expand(params + k * NUM_OF_PARAMS, batch_depths + k * num_depths);
+    sets = batch_depths;
+    stride = num_depths;
+  }
+  assign_new_params(params + (K - 1) * NUM_OF_PARAMS);
+  blk = P;
+  blk.N_units = num_prisms;
+
+  /* a chunk of the points at a time when they are streamed */
+  for (k = 0; k < K; k++) batch_ss[k] = 0.0;
+  first = 0;
+  do {
+    n = stream_load(first);
+    start = MPI_Wtime();
+    phase_begin(PHASE_COMPUTE);
+#ifdef NO_MPI
+    job.pa = &blk;
+    job.params = sets;
+    job.stride = stride;
+    job.K = K;
+    pool_for(n, calc_points_batch, &job);
+#else
+#pragma omp parallel for schedule(static)
+    for (i = 0; i < n; i++)
+      gbox_batch(pt+i, pr + first_prism, &blk, K, sets, stride, depth_index + first_prism, batch_calc + i * K);
+#endif
+    phase_end();
+    work_time += MPI_Wtime() - start;
+    work_points += (double)n * K;
+
+    if ( !my_rank && NONBLOCKING ) {
+      phase_begin(PHASE_SEND);
+      (void) wait_idle(&req);
+      phase_end();
+    }
+
+    /* The point group's leader adds up the fields of all prism blocks */
+    if (PRISM_BLOCKS > 1) {
+      start = MPI_Wtime();
+      phase_begin(PHASE_REDUCE);
+      ret = reduce_sum_long(block ? batch_calc : MPI_IN_PLACE, batch_calc, n * K, 0, row_comm);
+      phase_end();
+      idle_time += MPI_Wtime() - start;
+      if (ret) {
+        fprintf(stderr, "ERROR: ret=%d\n", ret);
+        for (k = 0; k < K; k++) fit[k] = 0.0;
+        return;
       }
     }
+
+    /* summed in point order, so the result does not depend on the number of threads */
+    phase_begin(PHASE_RMSE);
+    for (i = 0; i < n; i++) {
+      if ( !block )
+        for (k = 0; k < K; k++) {
+          error = batch_calc[i * K + k] - (pt+i)->observed;
+          batch_ss[k] += (error*error);
+        }
+      (pt+i)->calculated = batch_calc[i * K + K - 1];
+    }
+    phase_end();
+    first += n;
+  } while (first < num_pts);
+
+  /* the slave nodes do not wait for the reduction to complete (see finish_pending()) */
+  phase_begin(PHASE_REDUCE);
+  ret = MPI_Ireduce(batch_ss, batch_sum, K, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD, &pending);
+  phase_end();
+  if (ret) {
+    fprintf(stderr, "ERROR: ret=%d\n", ret);
+    for (k = 0; k < K; k++) fit[k] = 0.0;
+    return;
+  }
+  if ( !my_rank || !NONBLOCKING ) finish_pending();
+
+  /* Only the master node calculates the goodness-of-fit values */
+  phase_begin(PHASE_RMSE);
+  for (k = 0; k < K; k++) 
+    fit[k] = ( !my_rank ) ? rmse(batch_sum[k]) : 0.0;
+  phase_end();
+  last_sets = K;
+  if ( !my_rank )
+    for (k = 0; k < K; k++) note_best(sets + k * stride, fit[k], k);
+}
+
+/****************************************************************** 
+FUNCTION:  assign_new_params
+The function assigns updated parameter values to the anomaly being modeled.
+This happens before each calulation of the magnetic value. Nothing is
+copied: gbox() reads each prism's depth to bottom from param itself,
+through depth_index, so param must not change until the calculation 
+is done. With PARAM_BSPLINE the control values are first expanded into
+prism depths (see basis_expand()).
+INPUTS: (IN)  double param[]  (an array of new prism parameters to be tested) 
+RETURN:  none
+*******************************************************************/
+/* void assign_new_params( double param[]) { */
+void assign_new_params(double param[]) {
+  
+ P.density = param[DENSITY]; 
+ P.depth_to_top = param[DEPTH_TO_TOP]; 
+ if (PARAMETERIZATION == PARAM_BSPLINE) {
+   basis_expand(param, depths);
+   model = depths;
+ }
+ else model = param;
+}
+
+/****************************************************************** 
+FUNCTION:  expand_model
+Expands a parameter vector into the depth to bottom of every prism,
+for printing out (the prisms outside the mask are at MASK_DEPTH).
+INPUTS: (IN)  const double param[]  (the prism parameters) 
+        (OUT) double bot[]  (depth to the bottom of each prism)
+RETURN:  none
+*******************************************************************/
+static void expand_model(const double param[], double bot[]) {
+  int i;
+
+  for (i = 0; i < P.N_units; i++) 
+    bot[i] = (num_fixed && (pr+i)->b == CELL_MASKED) ? fixed_model[DEPTH_TO_BOT] : param[depth_index[i]];
+}
+
+/****************************************************************************
+FUNCTION: counted_rand
+This function returns rand() and counts the number of values drawn, so
+that the state of the random number generator can be checkpointed as
+(SEED, number of draws) and restored by replaying the sequence.
+INPUTS:  none
+RETURN:  int, the next value from rand()
+******************************************************************************/
+static int counted_rand(void) {
+  RAND_DRAWS++;
+  return rand();
+}
+
+void get_rng_state(unsigned int *seed, unsigned long *draws) {
+  *seed = SEED;
+  *draws = RAND_DRAWS;
+}
+
+void set_rng_state(unsigned int seed, unsigned long draws) {
+  SEED = seed;
+  srand(SEED);
+  for (RAND_DRAWS = 0; RAND_DRAWS < draws; ) (void) counted_rand();
 }
 
 void set_LOG(FILE *log  ) {
@@ -601,6 +1898,7 @@ void init_optimal_params(double op[][NUM_OF_PARAMS]) { /* init_optimal_params */
   
   fprintf(stderr, "ENTER[init_optimal_params]: NUM_OF_PARAMS=%d \n", NUM_OF_PARAMS);
   srand(SEED);
+  RAND_DRAWS = 0;
   
   for (vert=0; vert < NUM_OF_VERTICES; vert++) { /* for loop */
       
@@ -610,7 +1908,7 @@ void init_optimal_params(double op[][NUM_OF_PARAMS]) { /* init_optimal_params */
     */
     op[vert][DEPTH_TO_TOP] = 
 	 (double)LO_PARAM(DEPTH_TO_TOP) + 
-	 ((double)(HI_PARAM(DEPTH_TO_TOP) - LO_PARAM(DEPTH_TO_TOP)) * (double)rand()/(RAND_MAX+1.0));
+	 ((double)(HI_PARAM(DEPTH_TO_TOP) - LO_PARAM(DEPTH_TO_TOP)) * (double)counted_rand()/(RAND_MAX+1.0));
     /*  if (DEBUG == 3) fprintf(stderr, "  param[%d][%d]=%f ", vert, SURF_TO_TOP, op[vert][SURF_TO_TOP]);*/
     
     /* The second parameter is the rock density. 
@@ -619,7 +1917,7 @@ void init_optimal_params(double op[][NUM_OF_PARAMS]) { /* init_optimal_params */
     */
     op[vert][DENSITY] = 
 	 (double)LO_PARAM(DENSITY) + 
-	 ((double)(HI_PARAM(DENSITY)-LO_PARAM(DENSITY)) * (double)rand()/(RAND_MAX+1.0));
+	 ((double)(HI_PARAM(DENSITY)-LO_PARAM(DENSITY)) * (double)counted_rand()/(RAND_MAX+1.0));
     /* if (DEBUG == 3) fprintf(stderr, "  param[%d][%d]=%f ", vert, DENSITY, op[vert][DENSITY]); */
      
     /* The remaining parameters are the surface-to-bot values for each of the
@@ -630,7 +1928,7 @@ void init_optimal_params(double op[][NUM_OF_PARAMS]) { /* init_optimal_params */
     for (parm = DEPTH_TO_BOT; parm < NUM_OF_PARAMS; parm++) { /* for loop */
 	   op[vert][parm] = 
 	   (double)LO_PARAM(DEPTH_TO_BOT) + 
-	   ((double)(HI_PARAM(DEPTH_TO_BOT) - LO_PARAM(DEPTH_TO_BOT)) * (double)rand()/(RAND_MAX+1.0));
+	   ((double)(HI_PARAM(DEPTH_TO_BOT) - LO_PARAM(DEPTH_TO_BOT)) * (double)counted_rand()/(RAND_MAX+1.0));
 	   
 	   if (op[vert][parm] < op[vert][DEPTH_TO_TOP]) { op[vert][parm] = op[vert][DEPTH_TO_TOP]; }
 	   /*if (DEBUG == 3) fprintf(stderr, "  param[%d][%d]=%f ", vert, parm, op[vert][parm]); */
@@ -648,20 +1946,52 @@ void init_optimal_params(double op[][NUM_OF_PARAMS]) { /* init_optimal_params */
 }
 
 /*************************************************************************
-FUNCTION:  printout_points
-DESCRIPTION:  This function prints out the northing and easting
-coordinates along with the stored calculated magnetic value to the
-file "points.out".
-INPUTS:  none
+FUNCTION:   open_output
+DESCRIPTION:  Opens a temporary file for an output file; close_output()
+renames it over the output file, so that a reader never sees a 
+partly written file.
+INPUTS:  (IN) const char *name  (the output file)
+         (OUT) char *tmp  (the temporary file, MAX_FILENAME + 8 characters)
+OUTPUTS:  FILE *, or NULL on error
+ ************************************************************************/
+static FILE *open_output(const char *name, char *tmp) {
+  sprintf(tmp, "%s.tmp", name);
+  return fopen(tmp, "w");
+}
+
+/*************************************************************************
+FUNCTION:   close_output
+DESCRIPTION:  Closes a file from open_output() and renames it over the
+output file.
+INPUTS:  (IN) FILE *out
+         (IN) const char *tmp, *name  (the temporary and the output file)
+OUTPUTS:  int 1=error, 0=no error
+ ************************************************************************/
+static int close_output(FILE *out, const char *tmp, const char *name) {
+  if (fclose(out) || rename(tmp, name)) {
+    fprintf(stderr, "Cannot write [%s]:[%s]\n", name, strerror(errno));
+    (void) remove(tmp);
+    return 1;
+  }
+  return 0;
+}
+
+/*************************************************************************
+FUNCTION:   print_points
+DESCRIPTION:  This function prints out the calculated value at each point,
+in the order of the points file, to the file CALCULATED_GRAV.
+INPUTS:  (IN) const double calc[]  (the calculated value of each point of
+         p_all, or NULL for the values in p_all)
 OUTPUTS:  none
  ************************************************************************/
-void printout_points(void) {
+static void print_points(const double calc[]) {
 
-  int i;
+  long i, j;
   FILE *out_pt;
   FILE *out;
+  char tmp[MAX_FILENAME + 8];
 
-  out_pt = fopen(CALCULATED_GRAV, "w");
+  out_pt = open_output(CALCULATED_GRAV, tmp);
   if (out_pt == NULL) {
     fprintf(stderr, "Cannot open CALCULATED_GRAV file=[%s]:[%s]. Printing to STDOUT.\n", 
 	    CALCULATED_GRAV, strerror(errno)); 
@@ -669,29 +1999,353 @@ void printout_points(void) {
   } else 
     out = out_pt;
     
-  for (i=0; i < total_pts; i++) 
-    fprintf(out, "%f %f %f \n", 
-	    (p_all+i)->easting, (p_all+i)->northing, (p_all+i)->calculated);
+  /* in the order of the points file */
+  for (i=0; i < total_pts; i++) {
+    j = (place != NULL) ? place[i] : i;
+    fprintf(out, "%f %f %f \n", (p_all+j)->easting, (p_all+j)->northing, 
+            (calc != NULL) ? calc[j] : (p_all+j)->calculated);
+  }
 	    
-  if (out == out_pt) fclose(out);
+  if (out == out_pt) close_output(out, tmp, CALCULATED_GRAV);
+}
+
+#ifndef NO_MPI
+/* a point's row in the binary field file, and its position in pt */
+typedef struct field_row {
+  long row;
+  long index;
+} FIELD_ROW;
+
+static int compare_rows(const void *a, const void *b) {
+  long ra = ((const FIELD_ROW *)a)->row, rb = ((const FIELD_ROW *)b)->row;
+  return (ra > rb) - (ra < rb);
 }
 
 /*************************************************************************
-FUNCTION:   printout_model
-DESCRIPTION:  This function prints out the prism locations and each prism's
-set of parameters to the file "prisms.out".
+FUNCTION:   field_layout
+DESCRIPTION:  With HILBERT_ORDER a node's points are not one run of rows
+of the binary field file. The master sends each node the row of each of
+its points; the node sorts its points by row (an MPI-IO file view must
+go forward through the file). Called by every node.
+INPUTS:  none
+OUTPUTS:  int 1=error, 0=no error
+ ************************************************************************/
+static int field_layout(void) {
+
+  long i, n = recv_ct[my_rank];
+  long *row_all = NULL; /* master: the row of each point of p_all */
+  long *row; /* the row of each of this node's points */
+  FIELD_ROW *sorted;
+  int ret = 0;
+
+  if ( !my_rank ) {
+    row_all = (long *)temp_alloc((size_t)total_pts * sizeof(long));
+    if (row_all == NULL) ret = 1;
+    else for (i = 0; i < total_pts; i++) row_all[place[i]] = i;
+  }
+  row = (long *)temp_alloc((size_t)(n + 1) * sizeof(long));
+  sorted = (FIELD_ROW *)temp_alloc((size_t)(n + 1) * sizeof(FIELD_ROW));
+  write_order = (long *)scratch_buffer(SCRATCH_ORDER, (size_t)(n + 1) * sizeof(long));
+  write_disp = (MPI_Aint *)scratch_buffer(SCRATCH_DISP, (size_t)(n + 1) * sizeof(MPI_Aint));
+  if (row == NULL || sorted == NULL || write_order == NULL || write_disp == NULL) ret = 1;
+  MPI_Allreduce(MPI_IN_PLACE, &ret, 1, MPI_INT, MPI_LOR, MPI_COMM_WORLD);
+  if (ret) 
+    fprintf(stderr, "[%d-of-%d]\tCannot malloc memory for the field layout:[%s]\n",
+            my_rank, procs, strerror(errno));
+  else if (ret = scatterv_long(row_all, recv_ct, displ, row, n, MPI_LONG, 0, MPI_COMM_WORLD), ret)
+    fprintf(stderr, "[%d-of-%d]\tCannot scatter the field layout: ret=%d\n", my_rank, procs, ret);
+  else {
+    for (i = 0; i < n; i++) {
+      sorted[i].row = row[i];
+      sorted[i].index = i;
+    }
+    qsort(sorted, (size_t)n, sizeof(FIELD_ROW), compare_rows);
+    for (i = 0; i < n; i++) {
+      write_order[i] = sorted[i].index;
+      write_disp[i] = (MPI_Aint)(sorted[i].row * 3 * sizeof(double));
+    }
+  }
+  temp_free(row_all);
+  temp_free(row);
+  temp_free(sorted);
+  if (ret) write_order = NULL;
+  return ret ? 1 : 0;
+}
+#endif
+
+/*************************************************************************
+FUNCTION:   stream_field
+DESCRIPTION:  With STREAM_POINTS the calculated values are not kept. The
+field of the current prism model is calculated again, a chunk of points
+at a time, and each point group's leader writes the rows of each chunk
+at their place in the binary field file. A node whose points are not
+streamed writes the values it has. Called by every node.
+INPUTS:  (IN) MPI_File fh  (the binary field file; FILE * in the 
+         threads-only build)
+         (IN) int best  (1=the kept field of the best model, 0=the 
+         field of the last evaluation, for the points not streamed)
+OUTPUTS:  int 1=error, 0=no error
+ ************************************************************************/
+#ifdef NO_MPI
+static int stream_field(FILE *fh, int best) {
+#else
+static int stream_field(MPI_File fh, int best) {
+#endif
+
+  long i, first = 0, n;
+  double *rows;
+  PARAMETER blk; /* the parameters, for this node's block of prisms */
+  int ret = 0;
+
+  rows = (double *)scratch_buffer(SCRATCH_ROWS, (size_t)(3 * STREAM_POINTS + 1) * sizeof(double));
+  if (rows == NULL) {
+    fprintf(stderr, "[%d-of-%d]\tCannot malloc memory for the field rows:[%s]\n",
+            my_rank, procs, strerror(errno));
+    ret = 1;
+  }
+  blk = P;
+  blk.N_units = num_prisms;
+  do {
+    n = stream_load(first);
+    if (streaming) calc_chunk(n, &blk);
+    if (streaming && sum_blocks(n)) ret = 1;
+    if ( !block && rows != NULL ) {
+      for (i = 0; i < n; i++) {
+        rows[3*i] = (pt+i)->easting;
+        rows[3*i+1] = (pt+i)->northing;
+        rows[3*i+2] = (best && !streaming) ? (pt+i)->best : (pt+i)->calculated;
+      }
+#ifdef NO_MPI
+      if (fwrite(rows, sizeof(double), (size_t)(3 * n), fh) != (size_t)(3 * n)) ret = 1;
+#else
+      if (MPI_File_write_at(fh, (MPI_Offset)((stream_first + first) * 3 * sizeof(double)), 
+                            rows, (int)(3 * n), MPI_DOUBLE, MPI_STATUS_IGNORE)) ret = 1;
+#endif
+    }
+    first += n;
+  } while (first < num_pts);
+  return ret;
+}
+
+/*************************************************************************
+FUNCTION:   write_calculated
+DESCRIPTION:  Writes the calculated field to the binary file 
+CALCULATED_GRAV_BIN: one row of easting, northing and calculated value
+(doubles) for each point, in the order of the points file. Every point
+group's leader writes its own rows with collective MPI-IO, so nothing is
+gathered at the master. The rows go to a temporary file that the master
+renames when it is complete. Streamed points are written a chunk at a
+time (see stream_field()). Called by every node; the master first
+sends CMD_WRITE (see printout_points()) or CMD_DUMP (see dump_field()).
+INPUTS:  (IN) int best  (1=the kept field of the best model, 0=the 
+         field of the last evaluation)
+OUTPUTS:  int 1=error, 0=no error
+ ************************************************************************/
+int write_calculated(int best) {
+
+  char tmp[MAX_FILENAME + 8];
+  long i, j;
+  double *rows;
+  int ret = 0;
+#ifdef NO_MPI
+  FILE *out;
+
+  /* a single process: its points are all of the points, write them in file order */
+  out = open_output(CALCULATED_GRAV_BIN, tmp);
+  if (out == NULL) {
+    fprintf(stderr, "Cannot open [%s]:[%s]\n", tmp, strerror(errno));
+    return 1;
+  }
+  if (STREAM_POINTS > 0) ret = stream_field(out, best);
+  else {
+    rows = (double *)scratch_buffer(SCRATCH_ROWS, 3 * sizeof(double));
+    if (rows == NULL) ret = 1;
+    for (i = 0; i < total_pts && !ret; i++) {
+      j = (place != NULL) ? place[i] : i;
+      rows[0] = (pt+j)->easting;
+      rows[1] = (pt+j)->northing;
+      rows[2] = best ? (pt+j)->best : (pt+j)->calculated;
+      if (fwrite(rows, sizeof(double), 3, out) != 3) ret = 1;
+    }
+  }
+  /* a partly written file must not replace the old one */
+  if (ret) {
+    fprintf(stderr, "Cannot write [%s]:[%s]\n", tmp, strerror(errno));
+    (void) fclose(out);
+    (void) remove(tmp);
+    return 1;
+  }
+  return close_output(out, tmp, CALCULATED_GRAV_BIN);
+#else
+  MPI_File fh;
+  MPI_Datatype row, view;
+  long n;
+  int bad = 0; /* this node cannot write its rows */
+
+  finish_pending();
+  if (HILBERT_ORDER && write_order == NULL && field_layout()) return 1;
+  
+  n = (STREAM_POINTS > 0) ? 0 : recv_ct[my_rank]; /* zero unless this node is a point group's leader */
+  if (n > INT_MAX) {
+    fprintf(stderr, "[%d-of-%d]\tToo many points (%ld) for one binary write\n", my_rank, procs, n);
+    n = 0;
+    bad = 1;
+  }
+  rows = (double *)scratch_buffer(SCRATCH_ROWS, (size_t)(3 * n + 1) * sizeof(double));
+  if (rows == NULL) {
+    fprintf(stderr, "[%d-of-%d]\tCannot malloc memory for the field rows:[%s]\n",
+            my_rank, procs, strerror(errno));
+    n = 0;
+    bad = 1;
+  }
+  for (i = 0; i < n; i++) {
+    j = HILBERT_ORDER ? write_order[i] : i;
+    rows[3*i] = (pt+j)->easting;
+    rows[3*i+1] = (pt+j)->northing;
+    rows[3*i+2] = best ? (pt+j)->best : (pt+j)->calculated;
+  }
+  
+  sprintf(tmp, "%s.tmp", CALCULATED_GRAV_BIN);
+  if (ret = MPI_File_open(MPI_COMM_WORLD, tmp, MPI_MODE_CREATE | MPI_MODE_WRONLY, 
+                          MPI_INFO_NULL, &fh), ret) {
+    fprintf(stderr, "[%d-of-%d]\tCannot open [%s]: ret=%d\n", my_rank, procs, tmp, ret);
+    return 1;
+  }
+  MPI_File_set_size(fh, (MPI_Offset)(total_pts * 3 * sizeof(double)));
+  MPI_Type_contiguous(3, MPI_DOUBLE, &row);
+  MPI_Type_commit(&row);
+  if (STREAM_POINTS > 0) ret = stream_field(fh, best);
+  else if (HILBERT_ORDER) {
+    MPI_Type_create_hindexed_block((int)n, 1, write_disp, row, &view);
+    MPI_Type_commit(&view);
+    MPI_File_set_view(fh, 0, row, view, "native", MPI_INFO_NULL);
+    ret = MPI_File_write_all(fh, rows, (int)n, row, MPI_STATUS_IGNORE);
+    MPI_Type_free(&view);
+  }
+  else
+    ret = MPI_File_write_at_all(fh, (MPI_Offset)(displ[my_rank] * 3 * sizeof(double)), 
+                                rows, (int)n, row, MPI_STATUS_IGNORE);
+  MPI_Type_free(&row);
+  MPI_File_close(&fh);
+  
+  /* a node that wrote no rows leaves a hole in the file, which must not replace the old one */
+  if (bad && !ret) ret = 1;
+  MPI_Allreduce(MPI_IN_PLACE, &ret, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+  if (ret) {
+    if ( !my_rank ) {
+      fprintf(stderr, "Cannot write [%s]: ret=%d\n", tmp, ret);
+      remove(tmp);
+    }
+    return 1;
+  }
+  if ( !my_rank && rename(tmp, CALCULATED_GRAV_BIN)) {
+    fprintf(stderr, "Cannot rename [%s] to [%s]:[%s]\n", tmp, CALCULATED_GRAV_BIN, strerror(errno));
+    return 1;
+  }
+  return 0;
+#endif
+}
+
+/*************************************************************************
+FUNCTION:   printout_points
+DESCRIPTION:  This function gathers the calculated values from the nodes
+and prints them out to the file CALCULATED_GRAV, or has the nodes write
+them to CALCULATED_GRAV_BIN (see write_calculated()).
 INPUTS:  none
 OUTPUTS:  none
  ************************************************************************/
-void printout_model(void) {
+void printout_points(void) {
+
+  if (OUTPUT_FORMAT == OUTPUT_BINARY) {
+    send_command(CMD_WRITE, 0);
+    (void) write_calculated(0);
+    return;
+  }
+  /* The calculated values are still spread over the nodes */
+  send_command(CMD_GATHER, 0);
+  gather_calculated();
+  print_points(NULL);
+}
+
+/*************************************************************************
+FUNCTION:   print_model_binary
+DESCRIPTION:  This function writes the elevation of each prism's bottom
+as a grid of floats, north row first, to PRISM_BOT_GRID, with its ESRI
+header in PRISM_BOT_HEADER, and the depth to top, density and each 
+prism's outline and depth to bottom (doubles) to PRISM_GEOMETRY_BIN.
+It may run in the output writer thread, so it allocates no memory.
+INPUTS:  (IN) const double bot[]  (depth to the bottom of each prism)
+         (IN) double depth_to_top, density
+OUTPUTS:  none
+ ************************************************************************/
+static void print_model_binary(const double bot[], double depth_to_top, double density) {
+
+  float grid[1024];
+  double geom[5];
+  int i, k, one = 1;
+  FILE *out;
+  char tmp[MAX_FILENAME + 8];
+
+  out = open_output(PRISM_BOT_GRID, tmp);
+  if (out == NULL) {
+    fprintf(stderr, "Cannot output model to file:[%s]:[%s]\n", tmp, strerror(errno));
+    return;
+  }
+  for (i = 0; i < P.N_units; i += k) {
+    for (k = 0; k < 1024 && i + k < P.N_units; k++) grid[k] = (float)(0.0 - bot[i+k]);
+    if (fwrite(grid, sizeof(float), (size_t)k, out) != (size_t)k) break;
+  }
+  close_output(out, tmp, PRISM_BOT_GRID);
+  
+  out = open_output(PRISM_BOT_HEADER, tmp);
+  if (out != NULL) {
+    fprintf(out, "ncols %d\nnrows %d\nxllcorner %f\nyllcorner %f\ncellsize %f\n"
+            "nodata_value -9999\nbyteorder %s\n",
+            P.col, P.row, P.min_easting, P.max_northing - P.row * P.sp, P.sp,
+            *(char *)&one ? "LSBFIRST" : "MSBFIRST");
+    close_output(out, tmp, PRISM_BOT_HEADER);
+  }
+  
+  out = open_output(PRISM_GEOMETRY_BIN, tmp);
+  if (out != NULL) {
+    geom[0] = depth_to_top;
+    geom[1] = density;
+    (void) fwrite(geom, sizeof(double), 2, out);
+    for (i = 0; i < P.N_units; i++) {
+      geom[0] = (pr+i)->west;
+      geom[1] = (pr+i)->east;
+      geom[2] = (pr+i)->south;
+      geom[3] = (pr+i)->north;
+      geom[4] = bot[i];
+      if (fwrite(geom, sizeof(double), 5, out) != 5) break;
+    }
+    close_output(out, tmp, PRISM_GEOMETRY_BIN);
+  }
+}
+
+/*************************************************************************
+FUNCTION:   print_model
+DESCRIPTION:  This function prints out the prism locations and each prism's
+depth to bottom to the files PRISM_BOT_DEPTH and PRISM_GEOMETRY (or in
+binary, see print_model_binary()).
+INPUTS:  (IN) const double bot[]  (depth to the bottom of each prism)
+         (IN) double depth_to_top, density
+OUTPUTS:  none
+ ************************************************************************/
+static void print_model(const double bot[], double depth_to_top, double density) {
 
   int i;  
   FILE *model;
   FILE *out;
   FILE *out2;
+  char tmp[MAX_FILENAME + 8], tmp2[MAX_FILENAME + 8];
 
-  model = fopen(PRISM_BOT_DEPTH, "w");
-  out2 = fopen(PRISM_GEOMETRY, "w");
+  if (OUTPUT_FORMAT == OUTPUT_BINARY) {
+    print_model_binary(bot, depth_to_top, density);
+    return;
+  }
+  model = open_output(PRISM_BOT_DEPTH, tmp);
+  out2 = open_output(PRISM_GEOMETRY, tmp2);
   if (model == NULL) {
     fprintf(stderr, 
 	 "Cannot output model to file:[%s]. Printing to STDOUT.\n", strerror(errno)); 
@@ -702,16 +2356,16 @@ void printout_model(void) {
   
   if (out2 != NULL) {
 	 fprintf(out2, "%f %.2f\n",
-	 P.depth_to_top,
-    P.density);
+	 depth_to_top,
+    density);
     for (i=0; i < P.N_units; i++)
 	   fprintf(out2, "%f %f %f %f %.2f\n", 
 	   (pr+i)->west,
 		(pr+i)->east,
 		(pr+i)->south,
 		(pr+i)->north,
-		(pr+i)->depth_to_bottom);
-     (void) fclose(out2);
+		bot[i]);
+     close_output(out2, tmp2, PRISM_GEOMETRY);
     }
     
     /*fprintf(stderr, "Printing out prism model\n"); */
@@ -720,10 +2374,138 @@ void printout_model(void) {
 	   fprintf(out, "%f %f %f\n", 
 		((pr+i)->west + (pr+i)->east)/2.0,
 		((pr+i)->south + (pr+i)->north)/2.0,
-		0.0 - (pr+i)->depth_to_bottom);
+		0.0 - bot[i]);
     }
     
-  if (out == model) fclose(out);
+  if (out == model) close_output(out, tmp, PRISM_BOT_DEPTH);
+}
+
+/*************************************************************************
+FUNCTION:   printout_model
+DESCRIPTION:  This function prints out the current prism model (see 
+print_model()).
+INPUTS:  none
+OUTPUTS:  none
+ ************************************************************************/
+void printout_model(void) {
+  expand_model(model, bottom);
+  print_model(bottom, P.depth_to_top, P.density);
+}
+
+/*************************************************************************
+FUNCTION:   write_snapshot
+DESCRIPTION:  Prints out a snapshot of the model and its calculated field.
+It is called by the output writer thread (see writer.c), so it only
+reads data that do not change during the inversion, and the snapshot.
+INPUTS:  (IN) SNAPSHOT *snap
+OUTPUTS:  none
+ ************************************************************************/
+void write_snapshot(SNAPSHOT *snap) {
+  print_model(snap->bottom, snap->depth_to_top, snap->density);
+  if (OUTPUT_FORMAT == OUTPUT_TEXT) print_points(snap->calculated);
+}
+
+/*************************************************************************
+FUNCTION:   dump_field
+DESCRIPTION:  Dumps the kept field of the best model (see keep_best()).
+Called by every node; the master first sends CMD_DUMP (see dump_best()).
+A binary field is written by the nodes themselves, with the same 
+collective write as the final output (see write_calculated()), so the
+inversion waits for it. A text field is gathered into the snapshot
+without waiting: the master hands the snapshot to the output writer 
+once the gather has completed (see dump_complete()).
+INPUTS:  (IN) SNAPSHOT *snap  (master: the snapshot, its model filled 
+         in; NULL on the slave nodes)
+OUTPUTS:  none
+ ************************************************************************/
+void dump_field(SNAPSHOT *snap) {
+
+  long i;
+  int ret;
+  const double *m; /* the model of the last evaluation */
+  double top, density;
+
+  finish_pending();
+  if (STREAM_POINTS > 0) {
+    /* Streamed points keep no field: the nodes calculate the best model's
+       field a chunk at a time as they write it, then go back to the last model */
+    m = model;
+    top = P.depth_to_top;
+    density = P.density;
+    MPI_Bcast(best_model, num_depths, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    model = best_model;
+    P.depth_to_top = model[DEPTH_TO_TOP];
+    P.density = model[DENSITY];
+    (void) write_calculated(1);
+    model = m;
+    P.depth_to_top = top;
+    P.density = density;
+  }
+  else if (OUTPUT_FORMAT == OUTPUT_BINARY) (void) write_calculated(1);
+  if (OUTPUT_FORMAT == OUTPUT_BINARY) {
+    if (snap != NULL) writer_post(snap);
+    return;
+  }
+
+  /* the int counts of a nonblocking gather cannot hold every point */
+  if (total_pts > INT_MAX) {
+    if (ret = gatherv_long(&pt->best, recv_ct[my_rank], (p_all == NULL) ? NULL : &p_all->best, 
+                           recv_ct, displ, MPI_CALC, 0, MPI_COMM_WORLD), ret)
+      fprintf(stderr, "[%d-of-%d]\tCannot gather the best field: ret=%d\n", my_rank, procs, ret);
+    if (snap != NULL) {
+      for (i = 0; i < total_pts; i++) snap->calculated[i] = (p_all+i)->best;
+      writer_post(snap);
+    }
+    return;
+  }
+
+  if (snap == NULL) {
+    MPI_Igatherv(&pt->best, (int)recv_ct[my_rank], MPI_CALC, NULL, NULL, NULL, MPI_DOUBLE, 
+                 0, MPI_COMM_WORLD, &dump_req);
+    return;
+  }
+  for (i = 0; i < num_pts; i++) snap->calculated[displ[0] + i] = (pt+i)->best;
+  for (i = 0; i < procs; i++) {
+    dump_counts[i] = (int)recv_ct[i];
+    dump_displs[i] = (int)displ[i];
+  }
+  dump_snap = snap;
+  MPI_Igatherv(MPI_IN_PLACE, 0, MPI_CALC, snap->calculated, dump_counts, dump_displs, MPI_DOUBLE, 
+               0, MPI_COMM_WORLD, &dump_req);
+  dump_complete(0);
+}
+
+/*************************************************************************
+FUNCTION:   dump_best
+DESCRIPTION:  Hands the best model evaluated so far, and its calculated
+field, to the output writer if its RMSE is lower than at the last dump.
+The field is the one each node kept when that model was evaluated (see
+keep_best()), so nothing is evaluated again. The dump is skipped if the
+writer, or the gather of the last dump, is still busy. After --restart
+the dumps start from the best model evaluated by this run.
+INPUTS:  none
+OUTPUTS:  none
+ ************************************************************************/
+void dump_best(void) {
+
+  SNAPSHOT *snap;
+
+  dump_complete(0);
+  if (best_fit >= dumped_fit) return;
+  /* only a text field goes through the snapshot */
+  if (writer_start(P.N_units, (OUTPUT_FORMAT == OUTPUT_TEXT) ? total_pts : 1)) return;
+  snap = (dump_snap == NULL) ? writer_claim() : NULL;
+  if (snap == NULL) {
+    log_msg(LOG_INFO, "Output writer is busy, dump of RMSE=%f skipped\n", best_fit);
+    return;
+  }
+  snap->fit = best_fit;
+  snap->depth_to_top = best_model[DEPTH_TO_TOP];
+  snap->density = best_model[DENSITY];
+  expand_model(best_model, snap->bottom);
+  dumped_fit = best_fit;
+  send_command(CMD_DUMP, 0);
+  dump_field(snap);
 }
 
 /*************************************************************************
@@ -751,7 +2533,7 @@ void printout_parameters(double chi) {
   mini = P.depth_to_top;
   
   for (i=0; i < P.N_units; i++)
-	    if ((pr+i)->depth_to_bottom > mini) mini = (pr+i)->depth_to_bottom;
+	    if (bottom[i] > mini) mini = bottom[i];
   
   fprintf(out, "%s\nBest RMSE = %.1f\n\t%f to %f (Easting)\n\t%f to %f (Northing)\n\tSpacing = %.1f (meters)\n\nNumber of Parameters = %d\nNumber of Vertices = %d\nTolerance = %f\nPaP.rameter Ranges:\n\tRock Density: %2.f %2.f\n\tDepth-to-top: %.2f  %.2f\n\tDepth-to-bottom: %.2f  %.2f\n\t\nModeled Anomaly:\n\tBottom of Thickest Prism: %.2f (meters)\n\tTop Depth: %.2f(meters)\n\t\tRock Density: %.2f\n",
 	  asctime(localtime(&mytime)),
@@ -0,0 +1,242 @@
+/*
+	 File Name:   nompi/mpi.h
+
+	 Program Name:  grav_threads
+	 Release Date:         April 1, 2020
+	 Release Version:      1.0
+
+	 VERSION/REVISION HISTORY
+
+	 Single-process stand-in for the MPI library.
+
+
+	 DISCLAIMER/NOTICE
+
+	 This computer code/material was prepared as an account of work
+	 performed by the Center for Nuclear Waste Regulatory Analyses (CNWRA)
+	 for the Division of Waste Management of the Nuclear Regulatory
+	 Commission (NRC), an independent agency of the United States
+	 Government. The developer(s) of the code nor any of their sponsors
+	 make any warranty, expressed or implied, or assume any legal
+	 liability or responsibility for the accuracy, completeness, or
+	 usefulness of any information, apparatus, product or process
+	 disclosed, or represent that its use would not infringe on
+	 privately-owned rights.
+
+	 IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW WILL THE SPONSORS
+	 OR THOSE WHO HAVE WRITTEN OR MODIFIED THIS CODE, BE LIABLE FOR
+	 DAMAGES, INCLUDING ANY LOST PROFITS, LOST MONIES, OR OTHER SPECIAL,
+	 INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+	 INABILITY TO USE (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+	 BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY THIRD PARTIES OR A
+	 FAILURE OF THE PROGRAM TO OPERATE WITH OTHER PROGRAMS) THE PROGRAM,
+	 EVEN IF YOU HAVE BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGES,
+	 OR FOR ANY CLAIM BY ANY OTHER PARTY.
+
+
+	 PURPOSE:
+	 The threads-only build (make grav_threads-bot) compiles the same
+	 source files as the MPI build, with -Inompi so that #include <mpi.h>
+	 finds this file instead of the MPI library's. It provides the MPI
+	 calls used by the program for a single process (rank 0 of 1): a
+	 collective copies the send buffer to the receive buffer, a
+	 non-blocking operation is complete when it is started, and a shared
+	 memory window is ordinary memory. Point-to-point messages to another
+	 process are errors.
+
+	 PROGRAMMING LANGUAGE:  ANSI C
+*/
+#ifndef NOMPI_MPI_H
+#define NOMPI_MPI_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+typedef long MPI_Aint;
+typedef int MPI_Comm;
+typedef int MPI_Info;
+typedef int MPI_Op;
+typedef int MPI_Request;
+typedef void *MPI_Win;
+typedef struct {int MPI_SOURCE, MPI_TAG, MPI_ERROR;} MPI_Status;
+
+/* a datatype is <size> bytes of data every <extent> bytes */
+typedef struct nompi_type {size_t size; MPI_Aint extent;} *MPI_Datatype;
+
+static struct nompi_type nompi_double __attribute__((unused)) = {sizeof(double), sizeof(double)};
+static struct nompi_type nompi_int __attribute__((unused)) = {sizeof(int), sizeof(int)};
+static struct nompi_type nompi_long __attribute__((unused)) = {sizeof(long), sizeof(long)};
+static struct nompi_type nompi_byte __attribute__((unused)) = {1, 1};
+
+#define MPI_DOUBLE (&nompi_double)
+#define MPI_INT (&nompi_int)
+#define MPI_LONG (&nompi_long)
+#define MPI_BYTE (&nompi_byte)
+
+#define MPI_SUCCESS 0
+#define MPI_ERR_NO_MEM 1
+#define MPI_ERR_RANK 2
+#define MPI_COMM_WORLD 0
+#define MPI_COMM_NULL (-1)
+#define MPI_COMM_TYPE_SHARED 1
+#define MPI_INFO_NULL 0
+#define MPI_REQUEST_NULL 0
+#define MPI_SUM 1
+#define MPI_LAND 2
+#define MPI_THREAD_FUNNELED 1
+#define MPI_MODE_NOCHECK 0
+#define MPI_IN_PLACE ((void *)1)
+#define MPI_STATUS_IGNORE ((MPI_Status *)0)
+
+/* copies <count> elements of <type> */
+static inline void nompi_copy(void *to, const void *from, long count, MPI_Datatype type) {
+  long i;
+  if (to == from || from == MPI_IN_PLACE || count <= 0) return;
+  if ((MPI_Aint)type->size == type->extent) 
+    memmove(to, from, (size_t)count * type->size);
+  else 
+    for (i = 0; i < count; i++)
+      memmove((char *)to + i * type->extent, (const char *)from + i * type->extent, type->size);
+}
+
+static inline int MPI_Init_thread(int *argc, char ***argv, int required, int *provided) {
+  *provided = required;
+  return MPI_SUCCESS;
+}
+static inline int MPI_Finalize(void) { return MPI_SUCCESS; }
+static inline int MPI_Comm_rank(MPI_Comm comm, int *rank) { *rank = 0; return MPI_SUCCESS; }
+static inline int MPI_Comm_size(MPI_Comm comm, int *size) { *size = 1; return MPI_SUCCESS; }
+static inline int MPI_Comm_split(MPI_Comm comm, int color, int key, MPI_Comm *out) {
+  *out = comm;
+  return MPI_SUCCESS;
+}
+static inline int MPI_Comm_split_type(MPI_Comm comm, int type, int key, MPI_Info info, MPI_Comm *out) {
+  *out = comm;
+  return MPI_SUCCESS;
+}
+static inline int MPI_Comm_free(MPI_Comm *comm) { *comm = MPI_COMM_NULL; return MPI_SUCCESS; }
+static inline int MPI_Barrier(MPI_Comm comm) { return MPI_SUCCESS; }
+static inline double MPI_Wtime(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + 1.0e-6 * tv.tv_usec;
+}
+
+static inline int MPI_Type_contiguous(int count, MPI_Datatype old, MPI_Datatype *type) {
+  *type = (MPI_Datatype)malloc(sizeof(struct nompi_type));
+  if (*type == NULL) return MPI_ERR_NO_MEM;
+  (*type)->size = count * old->size;
+  (*type)->extent = count * old->extent;
+  return MPI_SUCCESS;
+}
+static inline int MPI_Type_create_resized(MPI_Datatype old, MPI_Aint lb, MPI_Aint extent, MPI_Datatype *type) {
+  *type = (MPI_Datatype)malloc(sizeof(struct nompi_type));
+  if (*type == NULL) return MPI_ERR_NO_MEM;
+  (*type)->size = old->size;
+  (*type)->extent = extent;
+  return MPI_SUCCESS;
+}
+static inline int MPI_Type_commit(MPI_Datatype *type) { return MPI_SUCCESS; }
+static inline int MPI_Type_get_extent(MPI_Datatype type, MPI_Aint *lb, MPI_Aint *extent) {
+  *lb = 0;
+  *extent = type->extent;
+  return MPI_SUCCESS;
+}
+
+static inline int MPI_Bcast(void *buf, int count, MPI_Datatype type, int root, MPI_Comm comm) {
+  return MPI_SUCCESS;
+}
+static inline int MPI_Ibcast(void *buf, int count, MPI_Datatype type, int root, MPI_Comm comm,
+                             MPI_Request *req) {
+  *req = MPI_REQUEST_NULL;
+  return MPI_SUCCESS;
+}
+static inline int MPI_Reduce(const void *send, void *recv, int count, MPI_Datatype type,
+                             MPI_Op op, int root, MPI_Comm comm) {
+  nompi_copy(recv, send, count, type);
+  return MPI_SUCCESS;
+}
+static inline int MPI_Ireduce(const void *send, void *recv, int count, MPI_Datatype type,
+                              MPI_Op op, int root, MPI_Comm comm, MPI_Request *req) {
+  *req = MPI_REQUEST_NULL;
+  return MPI_Reduce(send, recv, count, type, op, root, comm);
+}
+static inline int MPI_Allreduce(const void *send, void *recv, int count, MPI_Datatype type,
+                                MPI_Op op, MPI_Comm comm) {
+  nompi_copy(recv, send, count, type);
+  return MPI_SUCCESS;
+}
+static inline int MPI_Wait(MPI_Request *req, MPI_Status *status) {
+  *req = MPI_REQUEST_NULL;
+  return MPI_SUCCESS;
+}
+static inline int MPI_Test(MPI_Request *req, int *flag, MPI_Status *status) {
+  *req = MPI_REQUEST_NULL;
+  *flag = 1;
+  return MPI_SUCCESS;
+}
+static inline int MPI_Gather(const void *send, int sendcount, MPI_Datatype sendtype,
+                             void *recv, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm) {
+  nompi_copy(recv, send, sendcount, sendtype);
+  return MPI_SUCCESS;
+}
+static inline int MPI_Allgather(const void *send, int sendcount, MPI_Datatype sendtype,
+                                void *recv, int recvcount, MPI_Datatype recvtype, MPI_Comm comm) {
+  nompi_copy(recv, send, sendcount, sendtype);
+  return MPI_SUCCESS;
+}
+static inline int MPI_Gatherv(const void *send, int sendcount, MPI_Datatype sendtype,
+                              void *recv, const int counts[], const int displs[], 
+                              MPI_Datatype recvtype, int root, MPI_Comm comm) {
+  if (send != MPI_IN_PLACE) 
+    nompi_copy((char *)recv + displs[0] * recvtype->extent, send, sendcount, sendtype);
+  return MPI_SUCCESS;
+}
+static inline int MPI_Igatherv(const void *send, int sendcount, MPI_Datatype sendtype,
+                               void *recv, const int counts[], const int displs[], 
+                               MPI_Datatype recvtype, int root, MPI_Comm comm, MPI_Request *req) {
+  *req = MPI_REQUEST_NULL;
+  return MPI_Gatherv(send, sendcount, sendtype, recv, counts, displs, recvtype, root, comm);
+}
+static inline int MPI_Scatterv(const void *send, const int counts[], const int displs[],
+                               MPI_Datatype sendtype, void *recv, int recvcount,
+                               MPI_Datatype recvtype, int root, MPI_Comm comm) {
+  if (recv != MPI_IN_PLACE) 
+    nompi_copy(recv, (const char *)send + displs[0] * sendtype->extent, recvcount, recvtype);
+  return MPI_SUCCESS;
+}
+static inline int MPI_Sendrecv(const void *send, int sendcount, MPI_Datatype sendtype, int dest, int sendtag,
+                               void *recv, int recvcount, MPI_Datatype recvtype, int source, int recvtag,
+                               MPI_Comm comm, MPI_Status *status) {
+  nompi_copy(recv, send, sendcount, sendtype);
+  return MPI_SUCCESS;
+}
+static inline int MPI_Send(const void *buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm) {
+  return MPI_ERR_RANK;
+}
+static inline int MPI_Recv(void *buf, int count, MPI_Datatype type, int source, int tag,
+                           MPI_Comm comm, MPI_Status *status) {
+  return MPI_ERR_RANK;
+}
+
+static inline int MPI_Win_allocate_shared(MPI_Aint size, int disp_unit, MPI_Info info, MPI_Comm comm,
+                                          void *base, MPI_Win *win) {
+  *win = calloc(1, size ? (size_t)size : 1);
+  *(void **)base = *win;
+  return (*win == NULL) ? MPI_ERR_NO_MEM : MPI_SUCCESS;
+}
+static inline int MPI_Win_shared_query(MPI_Win win, int rank, MPI_Aint *size, int *disp_unit, void *base) {
+  *(void **)base = win;
+  return MPI_SUCCESS;
+}
+static inline int MPI_Win_lock_all(int assert, MPI_Win win) { return MPI_SUCCESS; }
+static inline int MPI_Win_unlock_all(MPI_Win win) { return MPI_SUCCESS; }
+static inline int MPI_Win_sync(MPI_Win win) { return MPI_SUCCESS; }
+static inline int MPI_Win_free(MPI_Win *win) {
+  free(*win);
+  *win = NULL;
+  return MPI_SUCCESS;
+}
+
+#endif
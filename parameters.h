@@ -50,6 +50,26 @@ extern int COLS;
 extern int NUM_OF_PARAMS;
 extern int NUM_OF_VERTICES;
 extern double TOLERANCE;
+extern int CHECKPOINT_INTERVAL;
+extern char CHECKPOINT_FILE[];
+extern int RESTART;
+extern int ADAPTIVE_SIMPLEX;
+extern int STALL_EVALS;
+extern double STALL_TOLERANCE;
+extern double REBUILD_STEP;
+extern int BATCH_SIZE;
+extern int REBALANCE_INTERVAL;
+extern int PRISM_BLOCKS;
+extern int NONBLOCKING;
+extern int HILBERT_ORDER;
+extern int OUTPUT_FORMAT;
+extern int LOG_LEVEL;
+extern int STREAM_POINTS;
+extern char MASK_FILE[];
+extern double MASK_DEPTH;
+extern int PARAMETERIZATION;
+extern int BASIS_ROWS;
+extern int BASIS_COLS;
 extern double _LO[];
 extern double _HI[];
  
@@ -58,6 +78,32 @@ extern double _HI[];
 #endif
 
 #define NMAX 500000
+
+/* gbox() shares the prisms among threads for grids at least this large */
+#define THREAD_MIN_PRISMS 1024
+
+/* smallest imbalance ratio (slowest node's time / mean time) worth repartitioning the points for */
+#define REBALANCE_THRESHOLD 1.05
+
+/* reusable scratch buffers (see scratch_buffer()) */
+enum {SCRATCH_POINTS, SCRATCH_BALANCE, SCRATCH_ROWS, SCRATCH_ORDER, SCRATCH_DISP, 
+      SCRATCH_COUNTS, SCRATCH_DISPLS, SCRATCH_BATCH, SCRATCH_BUFFERS};
+
+/* PARAMETERIZATION: one depth to bottom per free prism, or the control values of a
+   B-spline surface over the prisms (see basis.c) */
+enum {PARAM_PRISMS, PARAM_BSPLINE};
+
+/* PRISM.b of a prism outside MASK_FILE (the prisms are zeroed when allocated, so the others are 0) */
+#define CELL_MASKED 1
+
+/* phases of the run, each timed separately (see timer.c) */
+enum {PHASE_SEND, PHASE_COMPUTE, PHASE_REDUCE, PHASE_RMSE, PHASE_SIMPLEX, PHASE_OUTPUT, NUM_PHASES};
+
+/* levels of the log messages (see log.c) */
+enum {LOG_SUMMARY, LOG_INFO, LOG_DEBUG};
+
+/* commands broadcast by the master to the slave nodes (see slave()) */
+enum {CMD_QUIT, CMD_EVAL, CMD_BATCH, CMD_GATHER, CMD_REBALANCE, CMD_WRITE, CMD_DUMP};
 /*
 #define POINTS_OUT "points.out"
 #define PRISMS_OUT "prisms.out"
@@ -67,5 +113,23 @@ extern double _HI[];
 #define PRISM_GEOMETRY "prism_geometry.out"
 #define PRISM_BOT_DEPTH "prism_bottoms.out"
 #define PRISM_TOP_DEPTH "prism_tops.out"
+#define CHECKPOINT "grav_cube.ckpt"
+
+/* OUTPUT_FORMAT binary: a float grid with an ESRI header, prism outlines as doubles,
+   and the calculated field as rows of easting, northing, calculated (doubles) */
+enum {OUTPUT_TEXT, OUTPUT_BINARY};
+#define PRISM_BOT_GRID "prism_bottoms.flt"
+#define PRISM_BOT_HEADER "prism_bottoms.hdr"
+#define PRISM_GEOMETRY_BIN "prism_geometry.bin"
+#define CALCULATED_GRAV_BIN "calculated_grav.bin"
+#define PERFORMANCE_REPORT "performance.json"
+#define MAX_FILENAME 256
+
+/* binary survey files (see xyz2bin.c and SURVEY_HEADER) */
+#define SURVEY_MAGIC "GRAVSRVY"
+#define SURVEY_VERSION 1
+#define SURVEY_ALIGN 64 /* every column starts at a multiple of this many bytes */
+#define SURVEY_BYTE_ORDER 0x01020304 /* reads differently on a machine of the other byte order */
+enum {SURVEY_EASTING, SURVEY_NORTHING, SURVEY_ELEV, SURVEY_OBSERVED, SURVEY_COLUMNS};
 #define LO_PARAM(p) (double)_LO[(p)]
 #define HI_PARAM(p) (double)_HI[(p)]
@@ -40,13 +40,17 @@
 	 PROGRAMMING LANGUAGE:  ANSI C 
 */
 
+#include <mpi.h>
 #include "parameters.h"
 #include "common_structures.h"
 
-void optimize_params(double op[][NUM_OF_PARAMS], double mfv[], double tol,
-double (*funk)(double []), int *num_evals);
+void optimize_params(double op[][NUM_OF_PARAMS], double mfv[], double psum[], double tol,
+double (*funk)(double []), void (*bfunk)(double [], int, double []), int *num_evals, int resume);
+void evaluate_vertices(double op[][NUM_OF_PARAMS], double mfv[], int skip,
+void (*bfunk)(double [], int, double []));
 /*void smooth_model(double *m);*/
 double minimizing_func(double param[]);
+void minimizing_func_batch(double params[], int K, double fit[]);
 void test_bounds(int param, double *try, double bound);
 void init_optimal_params( double op[][NUM_OF_PARAMS]);
 void assign_new_params( double []);
@@ -56,9 +60,69 @@ void printout_model(void);
 void printout_points(void);
 void printout_parameters(double chi);
 int setup_prisms(void);
-void create_grid(double *param, double **GRID, PARAMETER P);
+int setup_process_grid(void);
+int create_index(int *index, const PRISM *pr, PARAMETER P);
+int mask_prisms(PRISM *pr, PARAMETER P);
+int basis_setup(const int *index, PARAMETER P);
+void basis_expand(const double *coef, double *depths);
+void phase_begin(int phase);
+void phase_end(void);
+void phase_rate(long evals, double seconds);
+int write_report(void);
 void slave(int my_rank, FILE *log_file);
 double master(void);
 void set_LOG(FILE *log_file);
-double rmse(void);
-double gbox(POINT *pt, PRISM *pr, PARAMETER *pa);
+double rmse(double ss);
+void send_command(int cmd, int count);
+void recv_command(int *cmd, int *count);
+void gather_calculated(void);
+int write_calculated(int best);
+int rebalance_points(void);
+void report_idle(void);
+double gbox(POINT *pt, PRISM *pr, const double *param, const int *index, PARAMETER *pa);
+void gbox_batch(POINT *pt, PRISM *pr, PARAMETER *pa, int K,
+const double *params, int stride, const int *index, double *g);
+void get_rng_state(unsigned int *seed, unsigned long *draws);
+void set_rng_state(unsigned int seed, unsigned long draws);
+int write_checkpoint(double op[][NUM_OF_PARAMS], double mfv[], double psum[], int num_evals);
+int read_checkpoint(double op[][NUM_OF_PARAMS], double mfv[], double psum[], int *num_evals);
+void get_stall_state(STALL *s);
+void set_stall_state(STALL *s);
+void install_signal_handlers(void);
+int checkpoint_requested(void);
+int init_node_comm(void);
+int is_node_root(void);
+void *shared_alloc(size_t bytes);
+void shared_sync(void);
+void shared_free(void);
+int gatherv_long(void *sendbuf, long sendcount, void *recvbuf,
+long counts[], long displs[], MPI_Datatype type, int root, MPI_Comm comm);
+int scatterv_long(void *sendbuf, long counts[], long displs[], void *recvbuf,
+long recvcount, MPI_Datatype type, int root, MPI_Comm comm);
+int bcast_long(void *buf, long count, MPI_Datatype type, int root, MPI_Comm comm);
+int reduce_sum_long(void *sendbuf, double *recvbuf, long count, int root, MPI_Comm comm);
+unsigned long hilbert_key(unsigned long x, unsigned long y);
+int hilbert_sort(POINT *p, long n, long place[]);
+long read_xyz(FILE *in, int threads, POINT **points, long *bytes);
+int writer_start(int num_prisms, long num_points);
+SNAPSHOT *writer_claim(void);
+void writer_post(SNAPSHOT *snap);
+void writer_stop(void);
+void write_snapshot(SNAPSHOT *snap);
+void dump_best(void);
+void dump_field(SNAPSHOT *snap);
+void dump_finish(void);
+void *arena_alloc(size_t bytes);
+void *scratch_buffer(int which, size_t bytes);
+void *temp_alloc(size_t bytes);
+void temp_free(void *p);
+void arena_release(void);
+unsigned long arena_allocations(void);
+size_t arena_held(void);
+void log_init(FILE *log);
+void log_msg(int level, const char *format, ...);
+void log_summary(const char *format, ...);
+double log_elapsed(void);
+int pool_init(int n);
+int pool_size(void);
+void pool_for(long n, void (*body)(long begin, long end, void *arg), void *arg);
@@ -0,0 +1,172 @@
+/*
+	 File Name:   shared_memory.c
+
+	 Program Name:  grav_parallel
+	 Subroutine Name(s): init_node_comm(), is_node_root(), shared_alloc(),
+	                     shared_sync(), shared_free()
+	 Release Date:         April 1, 2020
+	 Release Version:      1.0
+
+	 VERSION/REVISION HISTORY
+
+	 Node-shared storage for read-only data.
+
+
+	 DISCLAIMER/NOTICE
+
+	 This computer code/material was prepared as an account of work
+	 performed by the Center for Nuclear Waste Regulatory Analyses (CNWRA)
+	 for the Division of Waste Management of the Nuclear Regulatory
+	 Commission (NRC), an independent agency of the United States
+	 Government. The developer(s) of the code nor any of their sponsors
+	 make any warranty, expressed or implied, or assume any legal
+	 liability or responsibility for the accuracy, completeness, or
+	 usefulness of any information, apparatus, product or process
+	 disclosed, or represent that its use would not infringe on
+	 privately-owned rights.
+
+	 IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW WILL THE SPONSORS
+	 OR THOSE WHO HAVE WRITTEN OR MODIFIED THIS CODE, BE LIABLE FOR
+	 DAMAGES, INCLUDING ANY LOST PROFITS, LOST MONIES, OR OTHER SPECIAL,
+	 INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+	 INABILITY TO USE (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+	 BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY THIRD PARTIES OR A
+	 FAILURE OF THE PROGRAM TO OPERATE WITH OTHER PROGRAMS) THE PROGRAM,
+	 EVEN IF YOU HAVE BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGES,
+	 OR FOR ANY CLAIM BY ANY OTHER PARTY.
+
+
+	 PURPOSE:
+	 Data that never change during the inversion (the prism outlines, and
+	 any tables computed from them) are the same on every MPI process. These
+	 subroutines keep one copy of such data per compute node in an MPI
+	 shared-memory window: the first process on the node (the node root)
+	 allocates and fills the storage, and the other processes on that node
+	 read it in place. Data that change during the inversion stay in each
+	 process's own memory.
+
+	 PROGRAMMING LANGUAGE:  ANSI C
+
+	 GLOBAL VARIABLES:
+
+	 REFERENCES:
+
+	 PROGRAM FLOW:
+	 init_node_comm() once, then for each block of read-only data:
+	 shared_alloc(), fill it if is_node_root(), shared_sync().
+	 shared_free() before MPI_Finalize().
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include "prototypes.h"
+
+#define MAX_WINDOWS 16
+
+static MPI_Comm node_comm = MPI_COMM_NULL; /* the processes on this compute node */
+static int node_rank = 0; /* rank within node_comm */
+static int node_size = 1; /* number of processes on this compute node */
+static MPI_Win windows[MAX_WINDOWS]; /* every window allocated so far */
+static int num_windows = 0;
+
+/****************************************************************
+FUNCTION: init_node_comm
+DESCRIPTION: Groups the processes that share memory (i.e. that
+run on the same compute node).
+INPUTS: none
+OUTPUTS: int 1=error, 0=no error
+*****************************************************************/
+int init_node_comm(void) {
+
+  if (node_comm != MPI_COMM_NULL) return 0;
+  if (MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0,
+                          MPI_INFO_NULL, &node_comm) != MPI_SUCCESS) {
+    fprintf(stderr, "Cannot group the processes of this node\n");
+    return 1;
+  }
+  MPI_Comm_rank(node_comm, &node_rank);
+  MPI_Comm_size(node_comm, &node_size);
+  return 0;
+}
+
+/****************************************************************
+FUNCTION: is_node_root
+DESCRIPTION: Reports whether this process fills the node's shared
+storage.
+INPUTS: none
+OUTPUTS: int 1=node root, 0=other process on the node
+*****************************************************************/
+int is_node_root(void) {
+  return !node_rank;
+}
+
+/****************************************************************
+FUNCTION: shared_alloc
+DESCRIPTION: Allocates <bytes> of storage shared by all processes
+on this compute node. Every process on the node must call it, and
+every process gets the address of the same storage. The storage is
+zeroed. Until it has been filled by the node root and shared_sync()
+has been called it must not be read.
+INPUTS: (IN) size_t bytes  (size of the storage)
+OUTPUTS: void *, the shared storage, or NULL on error
+*****************************************************************/
+void *shared_alloc(size_t bytes) {
+
+  MPI_Win win;
+  MPI_Aint size;
+  int disp_unit;
+  void *base;
+
+  if (num_windows == MAX_WINDOWS) {
+    fprintf(stderr, "Too many shared memory windows (%d)\n", MAX_WINDOWS);
+    return NULL;
+  }
+  if (MPI_Win_allocate_shared(is_node_root() ? (MPI_Aint)bytes : 0, 1, MPI_INFO_NULL,
+                              node_comm, &base, &win) != MPI_SUCCESS) {
+    fprintf(stderr, "Cannot allocate %lu bytes of shared memory\n", (unsigned long)bytes);
+    return NULL;
+  }
+  /* every process addresses the node root's segment */
+  MPI_Win_shared_query(win, 0, &size, &disp_unit, &base);
+  if (is_node_root() && bytes) memset(base, 0, bytes);
+
+  /* passive target epoch for the life of the window, see shared_sync() */
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+  windows[num_windows++] = win;
+  return base;
+}
+
+/****************************************************************
+FUNCTION: shared_sync
+DESCRIPTION: Makes the node root's writes to shared storage visible
+to the other processes on the node. Every process on the node must
+call it.
+INPUTS: none
+OUTPUTS: none
+*****************************************************************/
+void shared_sync(void) {
+
+  int i;
+
+  for (i = 0; i < num_windows; i++) MPI_Win_sync(windows[i]);
+  MPI_Barrier(node_comm);
+  for (i = 0; i < num_windows; i++) MPI_Win_sync(windows[i]);
+}
+
+/****************************************************************
+FUNCTION: shared_free
+DESCRIPTION: Releases all shared storage. Every process must call
+it before MPI_Finalize().
+INPUTS: none
+OUTPUTS: none
+*****************************************************************/
+void shared_free(void) {
+
+  while (num_windows > 0) {
+    num_windows--;
+    MPI_Win_unlock_all(windows[num_windows]);
+    MPI_Win_free(&windows[num_windows]);
+  }
+  if (node_comm != MPI_COMM_NULL) MPI_Comm_free(&node_comm);
+}
@@ -41,7 +41,12 @@
     The slave nodes wait for new prism parameters from the master node.
     After receiving the new parameters, the node calls  minimizing_func() 
     with the new prism parameters and calculates its part of the field
-    values.
+    values. The master broadcasts a command before each step:
+    CMD_EVAL (one parameter set), CMD_BATCH (several parameter sets),
+    CMD_GATHER (send the calculated values for printing), CMD_REBALANCE
+    (repartition the points by node speed), CMD_WRITE (write the calculated
+    values to the binary field file), CMD_DUMP (dump the kept field of the
+    best model) or CMD_QUIT.
 
 	 
 	 PROGRAMMING LANGUAGE:  ANSI C 
@@ -67,12 +72,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <mpi.h>
-#include <gc.h>
 #include "prototypes.h"
 
-#define QUIT 0
-
 static double *recv_buffer=NULL;
+static double *batch_buffer=NULL; /* BATCH_SIZE parameter sets */
+static double *batch_fit=NULL;
 
 /******************************************************************
 INPUTS:  (IN)  int my_rank  (this slave node's id)
@@ -81,25 +85,46 @@ RETURN:  none
  *****************************************************************/
 void slave(int my_rank, FILE *log_file) {
 
-  int ret;
-  MPI_Status status;
+  int ret = 0, cmd, count;
   
   fprintf(log_file, "Slave[%d] here, ready ....\n",my_rank);
-  recv_buffer = (double *)GC_MALLOC((size_t)NUM_OF_PARAMS * sizeof(double));
-  if (recv_buffer == NULL) {
+  recv_buffer = (double *)arena_alloc((size_t)NUM_OF_PARAMS * sizeof(double));
+  batch_buffer = (double *)arena_alloc((size_t)BATCH_SIZE * NUM_OF_PARAMS * sizeof(double));
+  batch_fit = (double *)arena_alloc((size_t)BATCH_SIZE * sizeof(double));
+  if (recv_buffer == NULL || batch_buffer == NULL || batch_fit == NULL) {
     fprintf(log_file, "No room for receive buffer. Exiting/n");
       return;
   }
   for (;;) {
-    ret = MPI_Recv( (void *)recv_buffer, NUM_OF_PARAMS, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD, &status );
-    if ( recv_buffer[0] == QUIT ) { 
+    recv_command(&cmd, &count);
+    if ( cmd == CMD_QUIT ) { 
       fprintf(log_file, "\treceived QUIT [%d] . . .", ret);
       break;
     }
-   /* fprintf(stderr, "Receiving buffer ..."); */
-    ret = minimizing_func(recv_buffer);
-   /* fprintf(stderr, "Ret=%d\n",ret); */
+    /* The parameters themselves are broadcast inside the minimizing functions */
+    if ( cmd == CMD_EVAL ) 
+      ret = minimizing_func(recv_buffer);
+    else if ( cmd == CMD_BATCH )
+      minimizing_func_batch(batch_buffer, count, batch_fit);
+    else if ( cmd == CMD_GATHER ) {
+      phase_begin(PHASE_OUTPUT);
+      gather_calculated();
+      phase_end();
+    }
+    else if ( cmd == CMD_REBALANCE )
+      rebalance_points();
+    else if ( cmd == CMD_WRITE ) {
+      phase_begin(PHASE_OUTPUT);
+      (void) write_calculated(0);
+      phase_end();
+    }
+    else if ( cmd == CMD_DUMP ) {
+      phase_begin(PHASE_OUTPUT);
+      dump_field(NULL);
+      phase_end();
+    }
   }
+  dump_finish();
 
   fprintf(log_file, "Slave exiting ret=%d.\n", ret);
 }
@@ -51,6 +51,7 @@
 	 PROGRAM FLOW:
 */
 
+#include <stddef.h>
 #include "parameters.h"
 #include "common_structures.h"
 
@@ -107,87 +108,36 @@ void smooth(double *param, PARAMETER P, FILE *logfile) {
 */
 
 /******************************************************************
-FUNCTION: create_grid
-DESCRIPTION: This function fills in the interior of the grid with
-             the optimized parameters.
-INPUTS:  (IN/OUT)  double *param : the array of prism parameters being optimized 
+FUNCTION: create_index
+DESCRIPTION: This function maps each cell of the grid (prism, north
+             row first) to the parameter that is its depth to bottom.
+             The interior of the grid takes the optimized parameters
+             in order; the border cells have zero thickness, i.e. their
+             depth to bottom is the depth to top. The forward 
+             calculation reads each prism's depth through this map,
+             straight from the parameter vector. Only the interior
+             cells inside the mask are parameters of the simplex; the
+             others are at the depth to top here (see mask_prisms()).
+INPUTS:  (OUT) int *index : the parameter of each grid cell (NULL to
+               only count them)
+         (IN)  const PRISM *pr : the prisms, each marked with its kind
          (IN)  PARAMETER P : structure of model parameters
-         (IN/OUT) double **GRID : 2-D array of grid cells
-RETURN:  none
+RETURN:  int, the number of depth to bottom parameters
  *****************************************************************/
-void create_grid(double *param, double **GRID, PARAMETER P) {
+int create_index(int *index, const PRISM *pr, PARAMETER P) {
   
-  int x, y, i;
+  int x, y;
   int parm = DEPTH_TO_BOT;
   
-  /* Fill in the interior of the grid with the optimized parameters */
-  for (y=1; y < P.row-1; y++)
-    for (x=1; x < P.col-1; x++)
-      GRID[y][x] = param[parm++];
-
-  /* Now calculate the border cells.
-     based on the interior neighbor */
-
-  /* NORTH/SOUTH 
-  GRID[1][0] = (GRID[1][1] + GRID[2][1])/2.0;
-  GRID[P.col-2][0] = (GRID[P.col-3][1] + GRID[P.col-2][1])/2.0;
-  GRID[1][P.row-1] = (GRID[1][P.row-2] + GRID[2][P.row-2])/2.0;
-  GRID[P.col-2][P.row-1] = (GRID[P.col-3][P.row-2] + GRID[P.col-2][P.row-2])/2.0;
-  
-  GRID[1][0] = GRID[P.col-2][0] = GRID[1][P.row-1] = GRID[P.col-2][P.row-1] = param[SURF_TO_BOT];
-  */
-  i=0;
-  while (i < 2) {
-    if ( !i ) {
-      y = 0;
-      for (x = 1; x < P.col-1; x++)
-	      /*GRID[y][x] = GRID[y+1][x];*/
-	      GRID[y][x] = P.depth_to_top;
-    }
-    else {
-      y = P.row-1;
-      for (x = 1; x < P.col-1; x++)
-	      /* GRID[y][x] = GRID[y-1][x]; */
-	      GRID[y][x] = P.depth_to_top;
-    }  
-      /* if (x > 1 && x < P.col-2) 
-	 GRID[x][y-1] = (GRID[x-1][y] + GRID[x][y] + GRID[x-1][y])/3.0; */      
-    i++;
-  }
-
-  /* EAST/WEST 
-  GRID[0][1] = (GRID[1][1] + GRID[2][1])/2.0;
-  GRID[0][P.row-2] = (GRID[P.col-3][1] + GRID[P.col-2][1])/2.0;
-  GRID[P.col-1][1] = (GRID[1][P.row-2] + GRID[2][P.row-2])/2.0;
-  GRID[P.col-1][P.row-2] = (GRID[P.col-3][P.row-2] + GRID[P.col-2][P.row-2])/2.0;
-  GRID[0][1] = GRID[0][P.row-2] = GRID[P.col-1][1] = GRID[P.col-1][P.row-2] = param[SURF_TO_BOT];
-  */
-
-  i=0;
-  while (i < 2) {
-    if (!i){
-      x = 0;
-      for (y = 1; y < P.row-1; y++)
-	      /* GRID[y][x] = GRID[y][x+1]; */
-	      GRID[y][x] = P.depth_to_top;
-    }
-    else {
-      x = P.col-1;
-      for (y = 1; y < P.row-1; y++)
-	      /* GRID[y][x] = GRID[y][x-1]; */
-	      GRID[y][x] = P.depth_to_top;
-    } 
-    i++;
-  }
-
-  /* 4 CORNERS 
-  GRID[0][0] = GRID[1][1];
-  GRID[P.row-1][0] = GRID[P.row-2][1];
-  GRID[0][P.col-1] = GRID[1][P.col-2];
-  GRID[P.row-1][P.col-1] = GRID[P.row-2][P.col-2];
-  */
-  GRID[0][0] = P.depth_to_top;
-  GRID[P.row-1][0] = P.depth_to_top;
-  GRID[0][P.col-1] = P.depth_to_top;
-  GRID[P.row-1][P.col-1] = P.depth_to_top;
+  for (y=0; y < P.row; y++)
+    for (x=0; x < P.col; x++)
+      if (y == 0 || y == P.row-1 || x == 0 || x == P.col-1 ||
+          (pr + y * P.col + x)->b == CELL_MASKED) {
+        if (index != NULL) index[y * P.col + x] = DEPTH_TO_TOP;
+      }
+      else {
+        if (index != NULL) index[y * P.col + x] = parm;
+        parm++;
+      }
+  return parm - DEPTH_TO_BOT;
 }
@@ -0,0 +1,256 @@
+/*
+	 File Name:   threadpool.c
+
+	 Program Name:  grav_threads
+	 Subroutine Name(s): pool_init(), pool_size(), pool_for()
+	 Release Date:         April 1, 2020
+	 Release Version:      1.0
+
+	 VERSION/REVISION HISTORY
+
+	 Work-stealing thread pool for the threads-only build.
+
+
+	 DISCLAIMER/NOTICE
+
+	 This computer code/material was prepared as an account of work
+	 performed by the Center for Nuclear Waste Regulatory Analyses (CNWRA)
+	 for the Division of Waste Management of the Nuclear Regulatory
+	 Commission (NRC), an independent agency of the United States
+	 Government. The developer(s) of the code nor any of their sponsors
+	 make any warranty, expressed or implied, or assume any legal
+	 liability or responsibility for the accuracy, completeness, or
+	 usefulness of any information, apparatus, product or process
+	 disclosed, or represent that its use would not infringe on
+	 privately-owned rights.
+
+	 IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW WILL THE SPONSORS
+	 OR THOSE WHO HAVE WRITTEN OR MODIFIED THIS CODE, BE LIABLE FOR
+	 DAMAGES, INCLUDING ANY LOST PROFITS, LOST MONIES, OR OTHER SPECIAL,
+	 INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+	 INABILITY TO USE (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+	 BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY THIRD PARTIES OR A
+	 FAILURE OF THE PROGRAM TO OPERATE WITH OTHER PROGRAMS) THE PROGRAM,
+	 EVEN IF YOU HAVE BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGES,
+	 OR FOR ANY CLAIM BY ANY OTHER PARTY.
+
+
+	 PURPOSE:
+	 In the threads-only build (make grav_threads-bot) there is a single
+	 process, so every point is calculated by this process. pool_for()
+	 shares the points among a fixed set of threads. The points are cut
+	 into chunks and each thread starts with an equal run of chunks; it
+	 takes chunks from the front of its own run, and when its run is
+	 empty it steals the back half of another thread's run. A thread that
+	 is slowed down (by the operating system, or by points that are more
+	 costly) therefore does not hold up the others.
+
+	 PROGRAMMING LANGUAGE:  ANSI C
+
+	 GLOBAL VARIABLES:
+
+	 REFERENCES:
+
+	 PROGRAM FLOW:
+	 pool_init() once, then pool_for() for each parallel loop. The calling
+	 thread works as thread 0.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "prototypes.h"
+
+/* chunks per thread, so that there is something left to steal */
+#define CHUNKS_PER_THREAD 8
+
+/* a thread's run of chunks still to do, [next, end) */
+typedef struct run {
+  pthread_mutex_t lock;
+  long next;
+  long end;
+} RUN;
+
+static int num_threads = 0; /* including the calling thread */
+static pthread_t *threads = NULL;
+static RUN *runs = NULL;
+
+/* the loop being run */
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t job_done = PTHREAD_COND_INITIALIZER;
+static unsigned long job_number = 0; /* counts the loops started */
+static int busy = 0; /* threads still working on the loop */
+static void (*job_body)(long begin, long end, void *arg) = NULL;
+static void *job_arg = NULL;
+static long job_n = 0; /* number of iterations */
+static long job_chunk = 1; /* iterations per chunk */
+
+/****************************************************************
+FUNCTION: take_chunk
+DESCRIPTION: Takes the next chunk from thread <me>'s own run, or 
+failing that steals the back half of another thread's run.
+INPUTS: (IN) int me  (this thread)
+OUTPUTS: long, the chunk, or -1 when no chunks are left
+*****************************************************************/
+static long take_chunk(int me) {
+
+  int i, victim;
+  long chunk = -1, half;
+
+  pthread_mutex_lock(&runs[me].lock);
+  if (runs[me].next < runs[me].end) chunk = runs[me].next++;
+  pthread_mutex_unlock(&runs[me].lock);
+  if (chunk >= 0) return chunk;
+
+  for (i = 1; i < num_threads; i++) {
+    victim = (me + i) % num_threads;
+    pthread_mutex_lock(&runs[victim].lock);
+    half = (runs[victim].end - runs[victim].next) / 2;
+    if (half > 0) {
+      runs[victim].end -= half;
+      chunk = runs[victim].end;
+      pthread_mutex_unlock(&runs[victim].lock);
+
+      /* keep the rest of the stolen chunks as this thread's run */
+      pthread_mutex_lock(&runs[me].lock);
+      runs[me].next = chunk + 1;
+      runs[me].end = chunk + half;
+      pthread_mutex_unlock(&runs[me].lock);
+      return chunk;
+    }
+    if (runs[victim].next < runs[victim].end) chunk = runs[victim].next++;
+    pthread_mutex_unlock(&runs[victim].lock);
+    if (chunk >= 0) return chunk;
+  }
+  return -1;
+}
+
+/****************************************************************
+FUNCTION: work
+DESCRIPTION: Runs chunks of the current loop until none are left.
+INPUTS: (IN) int me  (this thread)
+OUTPUTS: none
+*****************************************************************/
+static void work(int me) {
+
+  long chunk, begin, end;
+
+  while ((chunk = take_chunk(me)) >= 0) {
+    begin = chunk * job_chunk;
+    end = (begin + job_chunk < job_n) ? begin + job_chunk : job_n;
+    job_body(begin, end, job_arg);
+  }
+}
+
+/****************************************************************
+FUNCTION: worker
+DESCRIPTION: Body of each pool thread: waits for a loop, works on
+it, and reports when it has run out of chunks.
+INPUTS: (IN) void *arg  (the thread number)
+OUTPUTS: none
+*****************************************************************/
+static void *worker(void *arg) {
+
+  int me = (int)(long)arg;
+  unsigned long seen = 0;
+
+  for (;;) {
+    pthread_mutex_lock(&job_lock);
+    while (job_number == seen) pthread_cond_wait(&job_start, &job_lock);
+    seen = job_number;
+    pthread_mutex_unlock(&job_lock);
+
+    work(me);
+
+    pthread_mutex_lock(&job_lock);
+    if (--busy == 0) pthread_cond_signal(&job_done);
+    pthread_mutex_unlock(&job_lock);
+  }
+  return NULL;
+}
+
+/****************************************************************
+FUNCTION: pool_init
+DESCRIPTION: Starts the pool's threads.
+INPUTS: (IN) int n  (number of threads, including the calling thread)
+OUTPUTS: int 1=error, 0=no error
+*****************************************************************/
+int pool_init(int n) {
+
+  int i;
+
+  if (n < 1) n = 1;
+  runs = (RUN *)calloc((size_t)n, sizeof(RUN));
+  threads = (pthread_t *)calloc((size_t)n, sizeof(pthread_t));
+  if (runs == NULL || threads == NULL) {
+    fprintf(stderr, "Cannot malloc memory for %d threads:[%s]\n", n, strerror(errno));
+    return 1;
+  }
+  for (i = 0; i < n; i++) pthread_mutex_init(&runs[i].lock, NULL);
+  num_threads = 1;
+  for (i = 1; i < n; i++) {
+    if (pthread_create(&threads[i], NULL, worker, (void *)(long)i)) {
+      fprintf(stderr, "Cannot start thread %d, using %d threads\n", i, num_threads);
+      break;
+    }
+    num_threads++;
+  }
+  return 0;
+}
+
+/****************************************************************
+FUNCTION: pool_size
+DESCRIPTION: Reports the number of threads in the pool.
+INPUTS: none
+OUTPUTS: int, the number of threads
+*****************************************************************/
+int pool_size(void) {
+  return (num_threads > 0) ? num_threads : 1;
+}
+
+/****************************************************************
+FUNCTION: pool_for
+DESCRIPTION: Runs body(begin, end, arg) over the iterations 0 to n-1,
+in chunks shared among the pool's threads. Returns when every
+iteration is done. The chunks run in no particular order, so the body
+must not depend on the order.
+INPUTS: (IN) long n  (number of iterations)
+        (IN) void (*body)(long begin, long end, void *arg)
+        (IN) void *arg  (passed to body)
+OUTPUTS: none
+*****************************************************************/
+void pool_for(long n, void (*body)(long begin, long end, void *arg), void *arg) {
+
+  int i;
+  long chunks;
+
+  if (n <= 0) return;
+  if (num_threads <= 1) {
+    body(0, n, arg);
+    return;
+  }
+  job_body = body;
+  job_arg = arg;
+  job_n = n;
+  job_chunk = n / ((long)num_threads * CHUNKS_PER_THREAD);
+  if (job_chunk < 1) job_chunk = 1;
+  chunks = (n + job_chunk - 1) / job_chunk;
+  for (i = 0; i < num_threads; i++) {
+    runs[i].next = chunks * i / num_threads;
+    runs[i].end = chunks * (i + 1) / num_threads;
+  }
+
+  pthread_mutex_lock(&job_lock);
+  busy = num_threads - 1;
+  job_number++;
+  pthread_cond_broadcast(&job_start);
+  pthread_mutex_unlock(&job_lock);
+
+  work(0);
+
+  pthread_mutex_lock(&job_lock);
+  while (busy > 0) pthread_cond_wait(&job_done, &job_lock);
+  pthread_mutex_unlock(&job_lock);
+}
@@ -0,0 +1,199 @@
+/*
+	 File Name:   timer.c
+
+	 Program Name:  grav_parallel
+	 Subroutine Name(s): phase_begin(), phase_end(), phase_rate(),
+	                     write_report()
+	 Release Date:         April 1, 2020
+	 Release Version:      1.0
+
+	 VERSION/REVISION HISTORY
+
+	 Per-phase timers and the performance report.
+
+
+	 DISCLAIMER/NOTICE
+
+	 This computer code/material was prepared as an account of work
+	 performed by the Center for Nuclear Waste Regulatory Analyses (CNWRA)
+	 for the Division of Waste Management of the Nuclear Regulatory
+	 Commission (NRC), an independent agency of the United States
+	 Government. The developer(s) of the code nor any of their sponsors
+	 make any warranty, expressed or implied, or assume any legal
+	 liability or responsibility for the accuracy, completeness, or
+	 usefulness of any information, apparatus, product or process
+	 disclosed, or represent that its use would not infringe on
+	 privately-owned rights.
+
+	 IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW WILL THE SPONSORS
+	 OR THOSE WHO HAVE WRITTEN OR MODIFIED THIS CODE, BE LIABLE FOR
+	 DAMAGES, INCLUDING ANY LOST PROFITS, LOST MONIES, OR OTHER SPECIAL,
+	 INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+	 INABILITY TO USE (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+	 BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY THIRD PARTIES OR A
+	 FAILURE OF THE PROGRAM TO OPERATE WITH OTHER PROGRAMS) THE PROGRAM,
+	 EVEN IF YOU HAVE BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGES,
+	 OR FOR ANY CLAIM BY ANY OTHER PARTY.
+
+
+	 PURPOSE:
+	 Each node adds up the time it spends in each phase of the run:
+	 waiting for the master's command and parameters (send), calculating
+	 the field (compute), adding up partial fields and sums of squares
+	 across nodes (reduce), calculating the misfit (rmse), the master's
+	 simplex bookkeeping (simplex), and writing the checkpoint, model and
+	 field (output). Phases nest: the time of an inner phase is not
+	 counted in the outer one, so e.g. the evaluations inside
+	 optimize_params() are not counted as simplex bookkeeping.
+
+	 At the end of the run write_report() collects every node's times
+	 into PERFORMANCE_REPORT, a JSON file beside parameters.README, with
+	 the minimum, maximum and mean over the nodes of each phase and the
+	 number of evaluations per second.
+
+	 PROGRAMMING LANGUAGE:  ANSI C
+
+	 GLOBAL VARIABLES:
+
+	 REFERENCES:
+
+	 PROGRAM FLOW:
+	 phase_begin(PHASE_...) and phase_end() around each phase, by the main
+	 thread only; write_report() once, by every node, at the end.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <mpi.h>
+#include "prototypes.h"
+
+#define MAX_NESTING 8
+
+static const char *phase_name[NUM_PHASES] = {"send", "compute", "reduce", "rmse", "simplex", "output"};
+static double phase_seconds[NUM_PHASES]; /* this node's time in each phase */
+static double phase_calls[NUM_PHASES]; /* number of times each phase was entered */
+static int stack[MAX_NESTING]; /* the phases being timed, innermost last */
+static int depth = 0; /* number of phases being timed */
+static int too_deep = 0; /* phases nested beyond MAX_NESTING, not timed */
+static double mark = 0.0; /* when the innermost phase was last charged */
+static long evaluations = 0; /* master: parameter sets evaluated while optimizing */
+static double optimize_seconds = 0.0; /* master: time spent optimizing */
+
+/****************************************************************
+FUNCTION: phase_begin
+DESCRIPTION: Starts timing a phase; the phase being timed, if any,
+is paused until phase_end().
+INPUTS: (IN) int phase  (PHASE_SEND ... PHASE_OUTPUT)
+OUTPUTS: none
+*****************************************************************/
+void phase_begin(int phase) {
+
+  double now = MPI_Wtime();
+
+  if (depth == MAX_NESTING) {
+    too_deep++;
+    return;
+  }
+  if (depth) phase_seconds[stack[depth-1]] += now - mark;
+  stack[depth++] = phase;
+  phase_calls[phase] += 1.0;
+  mark = now;
+}
+
+/****************************************************************
+FUNCTION: phase_end
+DESCRIPTION: Stops timing the phase started last, and resumes the
+one it interrupted.
+INPUTS: none
+OUTPUTS: none
+*****************************************************************/
+void phase_end(void) {
+
+  double now = MPI_Wtime();
+
+  if (too_deep) {
+    too_deep--;
+    return;
+  }
+  if ( !depth ) return;
+  phase_seconds[stack[--depth]] += now - mark;
+  mark = now;
+}
+
+/****************************************************************
+FUNCTION: phase_rate
+DESCRIPTION: Records how many parameter sets the master evaluated
+while optimizing, and how long that took, for the report.
+INPUTS: (IN) long evals  (number of parameter sets evaluated)
+        (IN) double seconds  (time spent optimizing)
+OUTPUTS: none
+*****************************************************************/
+void phase_rate(long evals, double seconds) {
+  evaluations = evals;
+  optimize_seconds = seconds;
+}
+
+/****************************************************************
+FUNCTION: write_report
+DESCRIPTION: Gathers every node's phase times to the master, which
+writes them to PERFORMANCE_REPORT and a summary line per phase to its
+log. Every node must call it.
+INPUTS: none
+OUTPUTS: int 1=error, 0=no error
+*****************************************************************/
+int write_report(void) {
+
+  double mine[2 * NUM_PHASES], *all = NULL;
+  double lo, hi, sum, calls;
+  int rank, procs, p, i, ok = 1;
+  FILE *out;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &procs);
+  memcpy(mine, phase_seconds, sizeof phase_seconds);
+  memcpy(mine + NUM_PHASES, phase_calls, sizeof phase_calls);
+  if ( !rank ) {
+    all = (double *)scratch_buffer(SCRATCH_BALANCE, (size_t)procs * 2 * NUM_PHASES * sizeof(double));
+    ok = all != NULL;
+    if ( !ok ) fprintf(stderr, "Cannot malloc memory for the performance report:[%s]\n", strerror(errno));
+  }
+  /* without the master's buffer there is nothing to gather into, so no node sends */
+  MPI_Bcast(&ok, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  if ( !ok ) return !rank;
+  MPI_Gather(mine, 2 * NUM_PHASES, MPI_DOUBLE, all, 2 * NUM_PHASES, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  if (rank) return 0;
+  out = fopen(PERFORMANCE_REPORT, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Cannot open [%s]:[%s]\n", PERFORMANCE_REPORT, strerror(errno));
+    return 1;
+  }
+  fprintf(out, "{\n  \"processes\": %d,\n  \"evaluations\": %ld,\n  \"optimize_seconds\": %.6f,\n"
+          "  \"evaluations_per_second\": %.3f,\n  \"phases\": {\n",
+          procs, evaluations, optimize_seconds, 
+          (optimize_seconds > 0.0) ? evaluations / optimize_seconds : 0.0);
+  for (p = 0; p < NUM_PHASES; p++) {
+    lo = hi = all[p];
+    sum = calls = 0.0;
+    for (i = 0; i < procs; i++) {
+      if (all[i * 2 * NUM_PHASES + p] < lo) lo = all[i * 2 * NUM_PHASES + p];
+      if (all[i * 2 * NUM_PHASES + p] > hi) hi = all[i * 2 * NUM_PHASES + p];
+      sum += all[i * 2 * NUM_PHASES + p];
+      calls += all[i * 2 * NUM_PHASES + NUM_PHASES + p];
+    }
+    fprintf(out, "    \"%s\": {\"min\": %.6f, \"max\": %.6f, \"mean\": %.6f, \"calls\": %.0f,\n"
+            "      \"per_rank\": [", phase_name[p], lo, hi, sum / procs, calls);
+    for (i = 0; i < procs; i++) 
+      fprintf(out, "%s%.6f", i ? ", " : "", all[i * 2 * NUM_PHASES + p]);
+    fprintf(out, "]}%s\n", (p < NUM_PHASES - 1) ? "," : "");
+    log_msg(LOG_SUMMARY, "[write_report] %-8s min %.3f max %.3f mean %.3f seconds\n", 
+            phase_name[p], lo, hi, sum / procs);
+  }
+  fprintf(out, "  }\n}\n");
+  if (fclose(out)) {
+    fprintf(stderr, "Cannot write [%s]:[%s]\n", PERFORMANCE_REPORT, strerror(errno));
+    return 1;
+  }
+  log_msg(LOG_SUMMARY, "[write_report] %ld evaluations in %.3f seconds\n", evaluations, optimize_seconds);
+  return 0;
+}
@@ -0,0 +1,185 @@
+/*
+	 File Name:   writer.c
+
+	 Program Name:  grav_parallel
+	 Subroutine Name(s): writer_start(), writer_claim(), writer_post(),
+	                     writer_stop(), writer_main()
+	 Release Date:         April 1, 2020
+	 Release Version:      1.0
+
+	 VERSION/REVISION HISTORY
+
+	 Background writer for the periodic model and field dumps.
+
+	 DISCLAIMER/NOTICE
+
+	 This computer code/material was prepared as an account of work
+	 performed by the Center for Nuclear Waste Regulatory Analyses (CNWRA)
+	 for the Division of Waste Management of the Nuclear Regulatory
+	 Commission (NRC), an independent agency of the United States
+	 Government. The developer(s) of the code nor any of their sponsors
+	 make any warranty, expressed or implied, or assume any legal
+	 liability or responsibility for the accuracy, completeness, or
+	 usefulness of any information, apparatus, product or process
+	 disclosed, or represent that its use would not infringe on
+	 privately-owned rights.
+
+	 IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW WILL THE SPONSORS
+	 OR THOSE WHO HAVE WRITTEN OR MODIFIED THIS CODE, BE LIABLE FOR
+	 DAMAGES, INCLUDING ANY LOST PROFITS, LOST MONIES, OR OTHER SPECIAL,
+	 INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+	 INABILITY TO USE (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+	 BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY THIRD PARTIES OR A
+	 FAILURE OF THE PROGRAM TO OPERATE WITH OTHER PROGRAMS) THE PROGRAM,
+	 EVEN IF YOU HAVE BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGES,
+	 OR FOR ANY CLAIM BY ANY OTHER PARTY.
+
+
+	 PURPOSE:
+	 Formatting the prism model and the calculated field as text takes
+	 longer than many evaluations on a large model, and the slave nodes
+	 would sit idle while the master wrote them. The master instead copies
+	 the best model into a snapshot, the nodes send it the field they kept
+	 when that model was evaluated (see dump_field()), and a thread writes
+	 the snapshot (see write_snapshot()) while the inversion goes on. There
+	 are two snapshots: one can be written while the other is filled and
+	 waits its turn. When both are in use the master skips the dump
+	 rather than wait.
+
+	 PROGRAMMING LANGUAGE:  ANSI C
+
+	 GLOBAL VARIABLES:
+
+	 REFERENCES:
+
+	 PROGRAM FLOW:
+	 writer_start() once; for each dump writer_claim(), fill the snapshot,
+	 writer_post(); writer_stop() before the final output is written.
+	 The writer thread makes no MPI calls.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "prototypes.h"
+
+static SNAPSHOT snaps[2];
+static SNAPSHOT *waiting = NULL; /* handed over, not yet being written */
+static SNAPSHOT *writing = NULL; /* being written */
+static int running = 0; /* the writer thread has been started */
+static int stopping = 0; /* the writer thread ends when nothing is waiting */
+static pthread_t writer;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_wake = PTHREAD_COND_INITIALIZER;
+
+/****************************************************************
+FUNCTION: writer_main
+DESCRIPTION: The writer thread: writes each snapshot handed over,
+until writer_stop() is called and nothing is left to write.
+INPUTS: (IN) void *arg  (not used)
+OUTPUTS: void *, NULL
+*****************************************************************/
+static void *writer_main(void *arg) {
+
+  pthread_mutex_lock(&writer_lock);
+  for (;;) {
+    while (waiting == NULL && !stopping) pthread_cond_wait(&writer_wake, &writer_lock);
+    if (waiting == NULL) break;
+    writing = waiting;
+    waiting = NULL;
+    pthread_mutex_unlock(&writer_lock);
+    
+    write_snapshot(writing);
+    
+    pthread_mutex_lock(&writer_lock);
+    writing = NULL;
+  }
+  pthread_mutex_unlock(&writer_lock);
+  return NULL;
+}
+
+/****************************************************************
+FUNCTION: writer_start
+DESCRIPTION: Allocates the two snapshots (once, from the arena) and
+starts the writer thread. Nothing is done if it is already running.
+INPUTS: (IN) int num_prisms  (prisms in the model)
+        (IN) long num_points  (points in the calculated field)
+OUTPUTS: int 1=error, 0=no error
+*****************************************************************/
+int writer_start(int num_prisms, long num_points) {
+
+  int i, ret;
+
+  if (running) return 0;
+  for (i = 0; i < 2; i++) {
+    if (snaps[i].bottom == NULL) snaps[i].bottom = (double *)arena_alloc((size_t)num_prisms * sizeof(double));
+    if (snaps[i].calculated == NULL) snaps[i].calculated = (double *)arena_alloc((size_t)num_points * sizeof(double));
+    if (snaps[i].bottom == NULL || snaps[i].calculated == NULL) {
+      fprintf(stderr, "Cannot malloc memory for the output snapshots:[%s]\n", strerror(errno));
+      return 1;
+    }
+  }
+  stopping = 0;
+  if (ret = pthread_create(&writer, NULL, writer_main, NULL), ret) {
+    fprintf(stderr, "Cannot start the output writer:[%s]\n", strerror(ret));
+    return 1;
+  }
+  running = 1;
+  return 0;
+}
+
+/****************************************************************
+FUNCTION: writer_claim
+DESCRIPTION: Finds a snapshot that the writer is not using. It does
+not wait: if one snapshot is being written and the other is waiting
+to be written, there is none.
+INPUTS: none
+OUTPUTS: SNAPSHOT *, the snapshot to fill, or NULL
+*****************************************************************/
+SNAPSHOT *writer_claim(void) {
+
+  SNAPSHOT *snap = NULL;
+  int i;
+
+  if (!running) return NULL;
+  pthread_mutex_lock(&writer_lock);
+  for (i = 0; i < 2 && snap == NULL; i++)
+    if (&snaps[i] != writing && &snaps[i] != waiting) snap = &snaps[i];
+  pthread_mutex_unlock(&writer_lock);
+  return snap;
+}
+
+/****************************************************************
+FUNCTION: writer_post
+DESCRIPTION: Hands a filled snapshot (from writer_claim()) to the
+writer. writer_claim() only returns a snapshot when none is waiting,
+so this one is next.
+INPUTS: (IN) SNAPSHOT *snap
+OUTPUTS: none
+*****************************************************************/
+void writer_post(SNAPSHOT *snap) {
+
+  pthread_mutex_lock(&writer_lock);
+  waiting = snap;
+  pthread_cond_signal(&writer_wake);
+  pthread_mutex_unlock(&writer_lock);
+}
+
+/****************************************************************
+FUNCTION: writer_stop
+DESCRIPTION: Waits until the writer has written every snapshot
+handed over, and ends the writer thread.
+INPUTS: none
+OUTPUTS: none
+*****************************************************************/
+void writer_stop(void) {
+
+  if (!running) return;
+  pthread_mutex_lock(&writer_lock);
+  stopping = 1;
+  pthread_cond_signal(&writer_wake);
+  pthread_mutex_unlock(&writer_lock);
+  (void) pthread_join(writer, NULL);
+  running = 0;
+}
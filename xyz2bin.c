@@ -0,0 +1,153 @@
+/*
+	 File Name:   xyz2bin.c
+
+	 Program Name:  xyz2bin
+	 Release Date:         April 1, 2020
+	 Release Version:      1.0
+
+	 VERSION/REVISION HISTORY
+
+	 Converts an observed gravity file to the binary survey format.
+
+
+	 DISCLAIMER/NOTICE
+
+	 This computer code/material was prepared as an account of work
+	 performed by the Center for Nuclear Waste Regulatory Analyses (CNWRA)
+	 for the Division of Waste Management of the Nuclear Regulatory
+	 Commission (NRC), an independent agency of the United States
+	 Government. The developer(s) of the code nor any of their sponsors
+	 make any warranty, expressed or implied, or assume any legal
+	 liability or responsibility for the accuracy, completeness, or
+	 usefulness of any information, apparatus, product or process
+	 disclosed, or represent that its use would not infringe on
+	 privately-owned rights.
+
+	 IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW WILL THE SPONSORS
+	 OR THOSE WHO HAVE WRITTEN OR MODIFIED THIS CODE, BE LIABLE FOR
+	 DAMAGES, INCLUDING ANY LOST PROFITS, LOST MONIES, OR OTHER SPECIAL,
+	 INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+	 INABILITY TO USE (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+	 BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY THIRD PARTIES OR A
+	 FAILURE OF THE PROGRAM TO OPERATE WITH OTHER PROGRAMS) THE PROGRAM,
+	 EVEN IF YOU HAVE BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGES,
+	 OR FOR ANY CLAIM BY ANY OTHER PARTY.
+
+
+	 PURPOSE:
+	 grav_parallel reads the observed gravity (OBS_GRAV_FILE) either as
+	 text, one "easting northing observed" line per point, or in the
+	 binary survey format written by this program. The binary file is a
+	 SURVEY_HEADER (count, bounds and column layout) followed by one
+	 column of doubles for each of easting, northing, elevation and
+	 observed value, each column aligned to SURVEY_ALIGN bytes. The
+	 elevation column is zero, as it is for text input.
+
+	 Usage: xyz2bin <text file> <binary file>
+
+	 PROGRAMMING LANGUAGE:  ANSI C
+
+	 GLOBAL VARIABLES:
+
+	 REFERENCES:
+
+	 PROGRAM FLOW:
+	 The text file is read twice: once to count the points and find the
+	 bounds, once to write the columns (each column through its own
+	 buffered stream, positioned at the column's offset).
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "parameters.h"
+#include "common_structures.h"
+
+/* The maximum line length */
+#define MAX_LINE 200
+
+int main(int argc, char *argv[]) {
+
+  char line[MAX_LINE];
+  SURVEY_HEADER head;
+  FILE *in, *col[SURVEY_COLUMNS] = {NULL};
+  double v[SURVEY_COLUMNS];
+  long line_num = 0, offset;
+  int c, ok = 1;
+  static const char *names[SURVEY_COLUMNS] = {"easting", "northing", "elev", "observed"};
+
+  if (argc != 3) {
+    fprintf(stderr, "USAGE: %s <text file> <binary file>\n", argv[0]);
+    return 1;
+  }
+  in = fopen(argv[1], "r");
+  if (in == NULL) {
+    fprintf(stderr, "Cannot open [%s]:[%s]\n", argv[1], strerror(errno));
+    return 1;
+  }
+
+  /* Count the points and find the bounds */
+  memset(&head, 0, sizeof head);
+  memcpy(head.magic, SURVEY_MAGIC, sizeof head.magic);
+  head.version = SURVEY_VERSION;
+  head.byte_order = SURVEY_BYTE_ORDER;
+  head.num_columns = SURVEY_COLUMNS;
+  head.size_of_double = (int)sizeof(double);
+  while (fgets(line, MAX_LINE, in) != NULL) {
+    line_num++;
+    if (line[0] == '#' || line[0] == '\n') continue;
+    if (sscanf(line, "%lf %lf %lf", &v[SURVEY_EASTING], &v[SURVEY_NORTHING], &v[SURVEY_OBSERVED]) != 3) {
+      fprintf(stderr, "[%s:%ld] Did not read in 3 values\n", argv[1], line_num);
+      fclose(in);
+      return 1;
+    }
+    if (!head.count || v[SURVEY_EASTING] < head.min_easting) head.min_easting = v[SURVEY_EASTING];
+    if (!head.count || v[SURVEY_EASTING] > head.max_easting) head.max_easting = v[SURVEY_EASTING];
+    if (!head.count || v[SURVEY_NORTHING] < head.min_northing) head.min_northing = v[SURVEY_NORTHING];
+    if (!head.count || v[SURVEY_NORTHING] > head.max_northing) head.max_northing = v[SURVEY_NORTHING];
+    head.count++;
+  }
+  rewind(in);
+
+  /* Lay out the columns */
+  offset = sizeof head;
+  for (c = 0; c < SURVEY_COLUMNS; c++) {
+    offset = (offset + SURVEY_ALIGN - 1) / SURVEY_ALIGN * SURVEY_ALIGN;
+    head.column_offset[c] = offset;
+    strncpy(head.column_name[c], names[c], sizeof head.column_name[c] - 1);
+    offset += head.count * (long)sizeof(double);
+  }
+
+  /* The header, then every column through its own stream */
+  col[0] = fopen(argv[2], "wb");
+  if (col[0] == NULL) {
+    fprintf(stderr, "Cannot open [%s]:[%s]\n", argv[2], strerror(errno));
+    fclose(in);
+    return 1;
+  }
+  ok = fwrite(&head, sizeof head, 1, col[0]) == 1;
+  ok = ok && !fflush(col[0]);
+  for (c = 1; c < SURVEY_COLUMNS && ok; c++) {
+    col[c] = fopen(argv[2], "r+b");
+    ok = col[c] != NULL;
+  }
+  for (c = 0; c < SURVEY_COLUMNS && ok; c++)
+    ok = !fseek(col[c], head.column_offset[c], SEEK_SET);
+
+  v[SURVEY_ELEV] = 0.0;
+  while (ok && fgets(line, MAX_LINE, in) != NULL) {
+    if (line[0] == '#' || line[0] == '\n') continue;
+    sscanf(line, "%lf %lf %lf", &v[SURVEY_EASTING], &v[SURVEY_NORTHING], &v[SURVEY_OBSERVED]);
+    for (c = 0; c < SURVEY_COLUMNS && ok; c++)
+      ok = fwrite(&v[c], sizeof(double), 1, col[c]) == 1;
+  }
+  fclose(in);
+  for (c = SURVEY_COLUMNS - 1; c >= 0; c--)
+    if (col[c] != NULL) ok = !fclose(col[c]) && ok;
+  if (!ok) {
+    fprintf(stderr, "Cannot write [%s]:[%s]\n", argv[2], strerror(errno));
+    return 1;
+  }
+  fprintf(stderr, "Wrote %ld points to [%s]\n", head.count, argv[2]);
+  return 0;
+}
@@ -0,0 +1,367 @@
+/*
+	 File Name:   xyz_parser.c
+
+	 Program Name:  grav_parallel
+	 Subroutine Name(s): read_xyz(), parse_double(), parse_line(),
+	                     count_pieces(), parse_pieces()
+	 Release Date:         April 1, 2020
+	 Release Version:      1.0
+
+	 VERSION/REVISION HISTORY
+
+	 Multi-threaded reader for observed gravity text files.
+
+	 DISCLAIMER/NOTICE
+
+	 This computer code/material was prepared as an account of work
+	 performed by the Center for Nuclear Waste Regulatory Analyses (CNWRA)
+	 for the Division of Waste Management of the Nuclear Regulatory
+	 Commission (NRC), an independent agency of the United States
+	 Government. The developer(s) of the code nor any of their sponsors
+	 make any warranty, expressed or implied, or assume any legal
+	 liability or responsibility for the accuracy, completeness, or
+	 usefulness of any information, apparatus, product or process
+	 disclosed, or represent that its use would not infringe on
+	 privately-owned rights.
+
+	 IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW WILL THE SPONSORS
+	 OR THOSE WHO HAVE WRITTEN OR MODIFIED THIS CODE, BE LIABLE FOR
+	 DAMAGES, INCLUDING ANY LOST PROFITS, LOST MONIES, OR OTHER SPECIAL,
+	 INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OR
+	 INABILITY TO USE (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+	 BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY THIRD PARTIES OR A
+	 FAILURE OF THE PROGRAM TO OPERATE WITH OTHER PROGRAMS) THE PROGRAM,
+	 EVEN IF YOU HAVE BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGES,
+	 OR FOR ANY CLAIM BY ANY OTHER PARTY.
+
+
+	 PURPOSE:
+	 The text points file (easting, northing and observed value on each
+	 line; lines that start with '#' and blank lines are skipped) is read
+	 in large blocks. Each block is cut into pieces at line boundaries and
+	 the pieces are parsed by the node's threads: first every piece counts
+	 its points, so that each knows where its points go, then every piece
+	 parses its points into place. Numbers are converted without sscanf()
+	 or the locale; a number that cannot be converted exactly by the fast
+	 method is handed to strtod(), so the values are the same as before.
+
+	 PROGRAMMING LANGUAGE:  ANSI C
+
+	 GLOBAL VARIABLES:
+
+	 REFERENCES:
+	 Clinger, W.D., 1990, How to read floating point numbers accurately,
+	 Proceedings of the ACM SIGPLAN '90 Conference on Programming Language
+	 Design and Implementation, p. 92-101.
+
+	 PROGRAM FLOW:
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "prototypes.h"
+
+#ifndef XYZ_BLOCK
+#define XYZ_BLOCK (64L << 20) /* bytes of the file read at a time */
+#endif
+#define PIECES_PER_THREAD 4 /* a block is cut into this many pieces per thread */
+#define XYZ_VALUES 3 /* easting, northing, observed */
+
+/* one block of the file, cut into pieces */
+typedef struct xyz_job {
+  const char *buf; /* the block */
+  long *start; /* offset of each piece in the block, and the end of the block */
+  long *lines; /* lines in each piece, then the line before the piece */
+  long *points; /* points in each piece, then the index of the piece's first point */
+  long *bad; /* first line of each piece that is not a point, or -1 */
+  POINT *to; /* the points of the file */
+} XYZ_JOB;
+
+/* powers of ten that are exact as doubles */
+static const double exact_pow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define IS_BLANK(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\v' || (c) == '\f')
+#define IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+
+/****************************************************************
+FUNCTION: parse_double
+DESCRIPTION: Converts the decimal number at *s. A number of at most
+19 significant digits whose value is below 2^53 and whose decimal
+exponent is at most 22 is converted exactly with one multiplication
+or division, and a zero with any exponent is converted directly; any
+other number (or infinity, nan, hexadecimal) is converted by strtod().
+The text must end in a character that is not part of a number.
+INPUTS: (IN/OUT) const char **s  (the number, then the character after it)
+        (OUT) double *v  (the value)
+OUTPUTS: int 1=converted, 0=not a number
+*****************************************************************/
+static int parse_double(const char **s, double *v) {
+
+  const char *p = *s;
+  char *end;
+  unsigned long long m = 0;
+  int neg = 0, digits = 0, any = 0, exp10 = 0, e = 0, eneg = 0;
+
+  if (*p == '+' || *p == '-') neg = (*p++ == '-');
+  for (; IS_DIGIT(*p); p++, any = 1)
+    if (m || *p != '0') {
+      if (++digits <= 19) m = m * 10 + (unsigned long long)(*p - '0');
+      else exp10++;
+    }
+  if (*p == '.') {
+    for (p++; IS_DIGIT(*p); p++, any = 1) {
+      if (m || *p != '0') {
+        if (++digits <= 19) { m = m * 10 + (unsigned long long)(*p - '0'); exp10--; }
+      }
+      else exp10--;
+    }
+  }
+  if (any && (*p == 'e' || *p == 'E')) {
+    const char *q = p + 1;
+    if (*q == '+' || *q == '-') eneg = (*q++ == '-');
+    if (IS_DIGIT(*q)) {
+      for (; IS_DIGIT(*q) && e < 10000; q++) e = e * 10 + (*q - '0');
+      exp10 += eneg ? -e : e;
+      p = q;
+    }
+  }
+  if (any && digits <= 19 && !IS_DIGIT(*p) && *p != 'x' && *p != 'X' && *p != '.') {
+    if (m == 0) { /* zero, whatever its exponent */
+      *v = neg ? -0.0 : 0.0;
+      *s = p;
+      return 1;
+    }
+    if (m <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22) {
+      *v = (exp10 < 0) ? (double)m / exact_pow10[-exp10] : (double)m * exact_pow10[exp10];
+      if (neg) *v = -*v;
+      *s = p;
+      return 1;
+    }
+  }
+  *v = strtod(*s, &end);
+  if (end == *s) return 0;
+  *s = end;
+  return 1;
+}
+
+/****************************************************************
+FUNCTION: parse_line
+DESCRIPTION: Reads the easting, northing and observed value at the
+start of a line of the points file; the rest of the line is ignored.
+INPUTS: (IN) const char *p  (the line)
+        (OUT) POINT *to
+OUTPUTS: int 1=a point, 0=not a point
+*****************************************************************/
+static int parse_line(const char *p, POINT *to) {
+
+  double v[XYZ_VALUES];
+  int c;
+
+  for (c = 0; c < XYZ_VALUES; c++) {
+    while (IS_BLANK(*p)) p++;
+    if (*p == '\n' || *p == '\0' || !parse_double(&p, &v[c])) return 0;
+  }
+  to->easting = v[0];
+  to->northing = v[1];
+  to->elev = 0.0;
+  to->observed = v[2];
+  to->calculated = 0.0;
+  return 1;
+}
+
+/****************************************************************
+FUNCTION: count_pieces
+DESCRIPTION: Counts the lines and the points of pieces <begin> to
+<end>-1 of a block.
+INPUTS: (IN) long begin, end  (the pieces)
+        (IN/OUT) void *arg  (XYZ_JOB *)
+OUTPUTS: none
+*****************************************************************/
+static void count_pieces(long begin, long end, void *arg) {
+
+  XYZ_JOB *job = (XYZ_JOB *)arg;
+  const char *p, *stop, *nl;
+  long k;
+
+  for (k = begin; k < end; k++) {
+    job->lines[k] = job->points[k] = 0;
+    p = job->buf + job->start[k];
+    stop = job->buf + job->start[k+1];
+    while (p < stop) {
+      job->lines[k]++;
+      if (*p != '#' && *p != '\n') job->points[k]++;
+      nl = memchr(p, '\n', (size_t)(stop - p));
+      p = (nl == NULL) ? stop : nl + 1;
+    }
+  }
+}
+
+/****************************************************************
+FUNCTION: parse_pieces
+DESCRIPTION: Parses the points of pieces <begin> to <end>-1 of a 
+block into place; count_pieces() must have been run first, and the
+counts turned into starting lines and points.
+INPUTS: (IN) long begin, end  (the pieces)
+        (IN/OUT) void *arg  (XYZ_JOB *)
+OUTPUTS: none
+*****************************************************************/
+static void parse_pieces(long begin, long end, void *arg) {
+
+  XYZ_JOB *job = (XYZ_JOB *)arg;
+  const char *p, *stop, *nl;
+  long k, line, n;
+
+  for (k = begin; k < end; k++) {
+    job->bad[k] = -1;
+    line = job->lines[k];
+    n = job->points[k];
+    p = job->buf + job->start[k];
+    stop = job->buf + job->start[k+1];
+    while (p < stop) {
+      line++;
+      if (*p != '#' && *p != '\n' && !parse_line(p, job->to + n++) && job->bad[k] < 0) 
+        job->bad[k] = line;
+      nl = memchr(p, '\n', (size_t)(stop - p));
+      p = (nl == NULL) ? stop : nl + 1;
+    }
+  }
+}
+
+/****************************************************************
+FUNCTION: read_xyz
+DESCRIPTION: Reads every point of a text points file. The points 
+are stored in an array that is allocated here.
+INPUTS: (IN) FILE *in  (the points file, at its start)
+        (IN) int threads  (number of threads that share the parsing)
+        (OUT) POINT **points  (the points)
+        (OUT) long *bytes  (the size of the file)
+OUTPUTS: long, the number of points, or -1 on error
+*****************************************************************/
+long read_xyz(FILE *in, int threads, POINT **points, long *bytes) {
+
+  XYZ_JOB job;
+  char *buf, save;
+  long have = 0, len, got, total = 0, lines = 0, cap = 0, n, k, pieces;
+  int eof = 0, ret = 0;
+
+  *points = NULL;
+  *bytes = 0;
+  pieces = (long)(threads > 0 ? threads : 1) * PIECES_PER_THREAD;
+  buf = (char *)malloc((size_t)XYZ_BLOCK + 1);
+  job.start = (long *)malloc((size_t)(pieces + 1) * sizeof(long));
+  job.lines = (long *)malloc((size_t)pieces * sizeof(long));
+  job.points = (long *)malloc((size_t)pieces * sizeof(long));
+  job.bad = (long *)malloc((size_t)pieces * sizeof(long));
+  if (buf == NULL || job.start == NULL || job.lines == NULL || job.points == NULL || job.bad == NULL) {
+    fprintf(stderr, "Cannot malloc memory for reading the points:[%s]\n", strerror(errno));
+    ret = 1;
+  }
+  job.buf = buf;
+
+  while (!ret && !eof) {
+    got = (long)fread(buf + have, 1, (size_t)(XYZ_BLOCK - have), in);
+    if (got < XYZ_BLOCK - have) {
+      if (ferror(in)) {
+        fprintf(stderr, "Cannot read the points file:[%s]\n", strerror(errno));
+        ret = 1;
+        break;
+      }
+      eof = 1;
+    }
+    have += got;
+    *bytes += got;
+    
+    /* The block ends after its last whole line, unless it is the end of the file */
+    len = have;
+    if (!eof) {
+      while (len > 0 && buf[len-1] != '\n') len--;
+      if (len == 0) {
+        fprintf(stderr, "A line of the points file is longer than %ld bytes\n", XYZ_BLOCK);
+        ret = 1;
+        break;
+      }
+    }
+    if (len == 0) break;
+    save = buf[len];
+    buf[len] = '\0';
+
+    /* Cut the block into pieces, each starting at the beginning of a line */
+    job.start[0] = 0;
+    for (k = 1; k < pieces; k++) {
+      const char *nl;
+      n = len * k / pieces;
+      if (n <= job.start[k-1]) n = job.start[k-1];
+      else if ((nl = memchr(buf + n - 1, '\n', (size_t)(len - n + 1))) == NULL) n = len;
+      else n = nl + 1 - buf;
+      job.start[k] = n;
+    }
+    job.start[pieces] = len;
+
+#ifdef NO_MPI
+    pool_for(pieces, count_pieces, &job);
+#else
+#pragma omp parallel for schedule(dynamic, 1)
+    for (k = 0; k < pieces; k++) count_pieces(k, k+1, &job);
+#endif
+    /* Each piece's first point and the line before it */
+    for (k = 0; k < pieces; k++) {
+      n = job.points[k];
+      job.points[k] = total;
+      total += n;
+      n = job.lines[k];
+      job.lines[k] = lines;
+      lines += n;
+    }
+    if (total > cap) {
+      cap = (2 * cap > total) ? 2 * cap : total;
+      job.to = (POINT *)realloc(*points, (size_t)cap * sizeof(POINT));
+      if (job.to == NULL) {
+        fprintf(stderr, "Cannot malloc memory for %ld points:[%s]\n", cap, strerror(errno));
+        ret = 1;
+        break;
+      }
+      *points = job.to;
+    }
+#ifdef NO_MPI
+    pool_for(pieces, parse_pieces, &job);
+#else
+#pragma omp parallel for schedule(dynamic, 1)
+    for (k = 0; k < pieces; k++) parse_pieces(k, k+1, &job);
+#endif
+    for (k = 0; k < pieces; k++)
+      if (job.bad[k] >= 0) {
+        fprintf(stderr, "[line=%ld] Did not read in 3 values\n", job.bad[k]);
+        ret = 1;
+        break;
+      }
+    
+    /* The partial line at the end of the block starts the next block */
+    buf[len] = save;
+    memmove(buf, buf + len, (size_t)(have - len));
+    have -= len;
+  }
+  free(buf);
+  free(job.start);
+  free(job.lines);
+  free(job.points);
+  free(job.bad);
+  if (ret) {
+    free(*points);
+    *points = NULL;
+    return -1;
+  }
+  
+  /* Give back the spare room */
+  if (total > 0 && total < cap) {
+    job.to = (POINT *)realloc(*points, (size_t)total * sizeof(POINT));
+    if (job.to != NULL) *points = job.to;
+  }
+  return total;
+}